@@ -3,20 +3,274 @@ var _ = require('underscore');
 var events = require('events');
 var util = require('util');
 
+/**
+ * There can only be one CanReadWriter per process, the native side passes signals to a single
+ * set of callbacks.
+ */
 var CanReadWriter = module.exports = function() {
     var self = this;
     this._mailbox = {};
-    return canReadWriter.start(function(name, value) {
+    this._sourceMailboxes = {};
+    this._aggregates = {};
+    this._sourceAggregates = {};
+
+    // Only signals with listeners (or explicit subscriptions) are decoded natively
+    this.on('newListener', function(event) {
+        if (isSignalEvent(event) && events.EventEmitter.listenerCount(self, event) === 0) {
+            canReadWriter.subscribe(event);
+        }
+    });
+    this.on('removeListener', function(event) {
+        if (isSignalEvent(event) && events.EventEmitter.listenerCount(self, event) === 0) {
+            canReadWriter.unsubscribe(event);
+        }
+    });
+
+    return canReadWriter.start(function(name, value, sourceAddress) {
         self._mailbox[name] = value;
-        self.emit(name, value);
+        if (sourceAddress !== undefined) {
+            var sourceMailbox = self._sourceMailboxes[sourceAddress] || (self._sourceMailboxes[sourceAddress] = {});
+            sourceMailbox[name] = value;
+        }
+        self.emit(name, value, sourceAddress);
+    }, function(name, aggregate, sourceAddress) {
+        self._aggregates[name] = aggregate;
+        if (sourceAddress !== undefined) {
+            var sourceAggregates = self._sourceAggregates[sourceAddress] || (self._sourceAggregates[sourceAddress] = {});
+            sourceAggregates[name] = aggregate;
+        }
+        self.emit('aggregate', name, aggregate, sourceAddress);
     });
 };
 
 util.inherits(CanReadWriter, events.EventEmitter);
 
+function isSignalEvent(event) {
+    return event !== 'newListener' && event !== 'removeListener' && event !== 'error' &&
+        event !== 'aggregate' && event !== 'rawFrames' && event !== 'busStats';
+}
+
+/**
+ * write(name, value[, priority][, callback]) and writeHs(...) queue a write on the LS and HS bus.
+ * Pending frames go out by priority class, then by id, and a write to a signal that is still
+ * pending replaces it. callback(err, timestamp) is called once the frame is acknowledged on the
+ * bus, with the driver time it went out, or with an error if it failed or was superseded. A
+ * frame that times out may still have gone out unacknowledged, so retrying can send it twice;
+ * check the signal's state before retrying a toggle.
+ */
 CanReadWriter.prototype.write = canReadWriter.write;
 CanReadWriter.prototype.writeHs = canReadWriter.writeHs;
-CanReadWriter.prototype.getMail = function(address) {
+
+/**
+ * Signal ids, assigned when the module loads: { read: { name: id }, ls: { name: id },
+ * hs: { name: id } }. writeId(id, value[, priority][, callback]) writes by id, skipping the
+ * name lookup, for code that writes often. Empty where the native side is a stub (Mac and
+ * Windows), so TestCanEmitter still loads there.
+ */
+CanReadWriter.signalIds = canReadWriter.signalIds ? canReadWriter.signalIds() : { read: {}, ls: {}, hs: {} };
+CanReadWriter.prototype.writeId = canReadWriter.writeId;
+
+/**
+ * Replaces the signal definitions of every CanReadWriter while the buses keep running.
+ * definitions can hold hs and ls, arrays of read signals like
+ * { id: 1954, name: 'batteryVoltage', startBit: 36, length: 12, scale: 0.25, offset: 0, unit: 'volts' },
+ * and writeHs and writeLs, objects of write signals like
+ * { hvacCommand: { id: 0x251, message: 0, startBit: 8, length: 2, priority: 2 } }.
+ * Parts left out are kept; with no definitions the built in ones are restored. Throws, changing
+ * nothing, if a definition is invalid. Ids of signals that are still defined don't change.
+ */
+CanReadWriter.reloadDefinitions = function(definitions) {
+    canReadWriter.reloadDefinitions(definitions);
+    CanReadWriter.signalIds = canReadWriter.signalIds();
+};
+
+CanReadWriter.PRIORITY_HIGH = 0;
+CanReadWriter.PRIORITY_NORMAL = 1;
+CanReadWriter.PRIORITY_LOW = 2;
+
+/**
+ * Decodes a signal without listening to it, so it can be polled with getMail. Each call needs a
+ * matching unsubscribe.
+ */
+CanReadWriter.prototype.subscribe = function(name) {
+    canReadWriter.subscribe(name);
+};
+CanReadWriter.prototype.unsubscribe = function(name) {
+    canReadWriter.unsubscribe(name);
+};
+
+/**
+ * Aggregates a signal natively. Every window ms (sliding by slide ms, which defaults to window)
+ * an 'aggregate' event fires with the signal name and an object holding the window's start, end,
+ * count, min, max, mean, last, integral (value * seconds) and rate (change per second).
+ * Windows close within 100ms of their end even if the signal goes quiet, and the integral holds
+ * the last value until the next sample. On a J1939 bus each source address is aggregated
+ * separately and passed after the aggregate, like with samples. Samples of the signal are still
+ * emitted only if it has listeners.
+ */
+CanReadWriter.prototype.aggregate = function(name, window, slide) {
+    canReadWriter.aggregate(name, window, slide);
+};
+CanReadWriter.prototype.unaggregate = function(name) {
+    canReadWriter.unaggregate(name);
+    delete this._aggregates[name];
+    _.each(this._sourceAggregates, function(sourceAggregates) {
+        delete sourceAggregates[name];
+    });
+};
+CanReadWriter.prototype.getAggregate = function(name, sourceAddress) {
+    if (sourceAddress !== undefined) {
+        return (this._sourceAggregates[sourceAddress] || {})[name];
+    }
+    return this._aggregates[name];
+};
+
+/**
+ * Opens the raw frame tap, a ring of every frame on the buses (and the frames we send, if
+ * includeTx) shared with native code as a Buffer. A 'rawFrames' event fires once per batch of
+ * new frames; call readRawFrames from it. Call closeRawTap when done. The ring is shared, so it
+ * holds the frames we send while anyone asked for them; readRawFrames skips those for you if
+ * you didn't.
+ */
+CanReadWriter.prototype.openRawTap = function(includeTx) {
+    var self = this;
+    if (!this._rawTap) {
+        this._rawTapCallback = function() {
+            self.emit('rawFrames');
+        };
+        this._rawTap = canReadWriter.openRawTap(!!includeTx, this._rawTapCallback);
+        this._rawTapIncludeTx = !!includeTx;
+        this._rawTapCursor = this._rawTap.readUInt32LE(0);
+    }
+    return this._rawTap;
+};
+
+/**
+ * Closes the raw frame tap. Once no one has it open the buses are filtered again.
+ */
+CanReadWriter.prototype.closeRawTap = function() {
+    if (this._rawTap) {
+        canReadWriter.closeRawTap(this._rawTapCallback);
+        this._rawTap = null;
+        this._rawTapCallback = null;
+    }
+};
+
+/**
+ * Calls fn(buffer, offset) for each frame added to the raw frame tap since the last call, where
+ * offset is the start of the frame's record (see CanReadWriter.rawFrame). Each record is copied
+ * out of the tap and checked before fn sees it, and the copy is reused, so copy out what you
+ * need. Returns the number of frames that were overwritten before being read, or 0 while the
+ * tap isn't open (a 'rawFrames' event can still arrive just after closeRawTap).
+ */
+CanReadWriter.prototype.readRawFrames = function(fn) {
+    var tap = this._rawTap;
+    if (!tap) {
+        return 0;
+    }
+    var capacity = tap.readUInt32LE(4);
+    var recordSize = tap.readUInt32LE(8);
+    var cursor = this._rawTapCursor;
+    var write = tap.readUInt32LE(0);
+    var lost = 0;
+
+    if (!this._rawRecord) {
+        this._rawRecord = new Buffer(recordSize);
+    }
+    while (cursor !== write) {
+        if (((write - cursor) >>> 0) > capacity) {
+            lost += ((write - cursor) >>> 0) - capacity;
+            cursor = (write - capacity) >>> 0;
+        }
+        var offset = 16 + (cursor % capacity) * recordSize;
+        tap.copy(this._rawRecord, 0, offset, offset + recordSize);
+
+        // The bus threads don't wait for us, so the record may have been reused while copying
+        write = tap.readUInt32LE(0);
+        if (((write - cursor) >>> 0) >= capacity) {
+            lost++;
+        } else if (this._rawTapIncludeTx || (this._rawRecord.readUInt8(13) & 0x80) === 0) {
+            fn(this._rawRecord, 0);
+        }
+        this._rawTapCursor = cursor = (cursor + 1) >>> 0;
+    }
+    return lost;
+};
+
+/**
+ * Decodes the raw frame tap record at offset into an object. Handy, but allocates.
+ */
+CanReadWriter.rawFrame = function(buffer, offset) {
+    var channel = buffer.readUInt8(offset + 13);
+    var dlc = buffer.readUInt8(offset + 12);
+    return {
+        id: buffer.readUInt32LE(offset),
+        timestamp: buffer.readUInt32LE(offset + 4),
+        flags: buffer.readUInt32LE(offset + 8),
+        dlc: dlc,
+        channel: channel & 0x7F,
+        tx: (channel & 0x80) !== 0,
+        data: buffer.slice(offset + 16, offset + 16 + Math.min(dlc, 8))
+    };
+};
+
+/**
+ * Logs signals natively to a compact file at path, replacing it, until stopLog. Samples are
+ * compressed per signal (delta-of-delta timestamps, XOR'd values) and written by a background
+ * thread. Signals are decoded for the log whether or not they have listeners. Only one log can
+ * be open at a time. stopLog([callback]) returns right away and calls back once the file is
+ * written out and closed.
+ */
+CanReadWriter.startLog = canReadWriter.startLog;
+CanReadWriter.stopLog = canReadWriter.stopLog;
+
+/**
+ * Reads a log written by startLog in the background. Calls callback(err, series) with an array
+ * of { name, sourceAddress, timestamps, values } per signal (and J1939 source address).
+ * timestamps (ms since the epoch) and values are Buffers of doubles; read sample i with
+ * readDoubleLE(8 * i).
+ */
+CanReadWriter.readLog = canReadWriter.readLog;
+
+var analyzing = [];
+
+/**
+ * Measures both buses, opening up the acceptance filters, and emits 'busStats' every interval ms
+ * with a snapshot per bus: { bus: 'hs' or 'ls', start, end, frames, errorFrames, load (0 to 1,
+ * without stuff bits), untracked (frames of ids past the analyzer's limit), ids }, where each
+ * of ids holds an id's extended, count, rate (frames per second), minPeriod, maxPeriod,
+ * meanPeriod, jitter (standard deviation of the period), missing (frames that should have
+ * arrived but didn't), stalled and lastSeen. Times are driver timestamps in ms. The interval is
+ * shared by every CanReadWriter; the last one set wins.
+ */
+CanReadWriter.prototype.analyzeBus = function(interval) {
+    if (analyzing.indexOf(this) === -1) {
+        analyzing.push(this);
+    }
+    canReadWriter.startAnalyzer(interval, function(snapshot) {
+        analyzing.forEach(function(listener) {
+            listener.emit('busStats', snapshot);
+        });
+    });
+};
+CanReadWriter.prototype.stopAnalyzingBus = function() {
+    var index = analyzing.indexOf(this);
+    if (index !== -1) {
+        analyzing.splice(index, 1);
+        if (analyzing.length === 0) {
+            canReadWriter.stopAnalyzer();
+        }
+    }
+};
+
+/**
+ * Returns the last value received for a signal. On a J1939 bus, pass a source address to get
+ * the last value sent by that node, otherwise the last value from any node is returned.
+ */
+CanReadWriter.prototype.getMail = function(address, sourceAddress) {
+    if (sourceAddress !== undefined) {
+        return (this._sourceMailboxes[sourceAddress] || {})[address];
+    }
     return this._mailbox[address];
 };
 
@@ -132,5 +386,16 @@ TestCanEmitter.prototype.getMail = function(address) {
     return this[address];
 };
 
+TestCanEmitter.prototype.subscribe = function() {};
+TestCanEmitter.prototype.unsubscribe = function() {};
+TestCanEmitter.prototype.aggregate = function() {};
+TestCanEmitter.prototype.unaggregate = function() {};
+TestCanEmitter.prototype.getAggregate = function() {};
+TestCanEmitter.prototype.openRawTap = function() {};
+TestCanEmitter.prototype.closeRawTap = function() {};
+TestCanEmitter.prototype.readRawFrames = function() { return 0; };
+TestCanEmitter.prototype.analyzeBus = function() {};
+TestCanEmitter.prototype.stopAnalyzingBus = function() {};
 TestCanEmitter.prototype.write = function() {};
 TestCanEmitter.prototype.writeHs = function() {};
+TestCanEmitter.prototype.writeId = function() {};
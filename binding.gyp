@@ -1,4 +1,7 @@
 {
+    "variables": {
+        "heavy_duty%": 0
+    },
     "targets": [
         {
             "target_name": "canReadWriter",
@@ -7,7 +10,12 @@
                     "sources": [ "canReadWriter.cpp" ],
                     "cflags_cc": [ "-std=gnu++11" ],
                     "libraries": [ "/usr/lib/libcanlib.so" ],
-                    "include_dirs": [ "/usr/include" ]  
+                    "include_dirs": [ "/usr/include" ],
+                    "conditions": [
+                        ["heavy_duty==1", {
+                            "defines": [ "HEAVY_DUTY" ]
+                        }]
+                    ]
                 }],
                 ["OS=='mac' or OS=='win'", {
                     "sources": [ "canReadWriterMacWin.cpp" ],
@@ -1,23 +1,46 @@
 #include <node.h>
+#include <node_buffer.h>
 
 extern "C" {
     #include <canlib.h>
 }
 
+#include <algorithm>
+#include <atomic>
+#include <map>
 #include <queue>
 #include <string>
+#include <tuple>
+#include <fcntl.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <unordered_map>
 #include <vector>
 
 // C standard library
+#include <cerrno>
+#include <climits>
+#include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 
+#define ID_FORMAT_GMLAN 0
+#define ID_FORMAT_J1939 1
+
 #define HS_CHANNEL 0
+#ifdef HEAVY_DUTY
+// The heavy-duty variant runs J1939 on the HS channel
+#define HS_BAUD 250000
+#define HS_TSEG1 5
+#define HS_TSEG2 2
+#define HS_ID_FORMAT ID_FORMAT_J1939
+#else
 #define HS_BAUD 500000
 #define HS_TSEG1 4
 #define HS_TSEG2 3
+#define HS_ID_FORMAT ID_FORMAT_GMLAN
+#endif
 #define HS_SJW 1
 #define HS_SAMPLE_POINTS 1
 #define HS_SYNC_MODE 0
@@ -31,6 +54,93 @@ extern "C" {
 #define LS_SAMPLE_POINTS 1
 #define LS_SYNC_MODE 0
 #define LS_FLAGS 0
+#define LS_ID_FORMAT ID_FORMAT_GMLAN
+
+// J1939 transport protocol (J1939-21)
+#define J1939_PGN_TP_CM 0xEC00
+#define J1939_PGN_TP_DT 0xEB00
+#define J1939_TP_CM_RTS 16
+#define J1939_TP_CM_CTS 17
+#define J1939_TP_CM_BAM 32
+#define J1939_TP_CM_ABORT 255
+#define J1939_TP_MAX_LENGTH 1785
+#define J1939_TP_TIMEOUT 1250
+#define J1939_GLOBAL_ADDRESS 255
+
+// Longest sliding window, in slides
+#define MAX_AGGREGATE_PANES 1000
+
+// Raw frame tap layout, see rawFrameTap. RAW_TAP_FRAMES must be a power of two.
+#define RAW_TAP_FRAMES 4096
+#define RAW_TAP_HEADER_SIZE 16
+#define RAW_TAP_RECORD_SIZE 24
+#define RAW_TAP_TX 0x80
+
+// How long ReadMessages waits for a frame before checking for subscription changes (ms)
+#define READ_TIMEOUT 100
+
+// The id of the tick ReadMessages queues every READ_TIMEOUT of driver time, so aggregation
+// windows close on a quiet bus
+#define READ_TICK_ID -1
+
+// Bus analyzer limits, see busAnalyzer. ANALYZER_EXT_BUCKETS must be a power of two
+// larger than ANALYZER_MAX_IDS.
+#define ANALYZER_MAX_IDS 512
+#define ANALYZER_EXT_BUCKETS 1024
+#define ANALYZER_STD_IDS 2048
+
+// A period this many times the expected one means frames went missing, and this many late
+// periods in a row mean the id changed its period
+#define ANALYZER_LATE_FACTOR 1.5
+#define ANALYZER_LATE_RESET 4
+
+// An id not seen for this many expected periods has stalled
+#define ANALYZER_STALL_FACTOR 3
+
+// Frame bits besides the data: SOF, arbitration, control, CRC, ACK, EOF and interframe
+// space. Stuff bits aren't counted, so the bus load is a lower bound.
+#define STD_FRAME_OVERHEAD_BITS 47
+#define EXT_FRAME_OVERHEAD_BITS 67
+
+// Signal log format, see signalLogger
+#define LOG_MAGIC "CRWLOG1"
+#define LOG_RECORD_NAME 'N'
+#define LOG_RECORD_CHUNK 'C'
+#define LOG_CHUNK_HEADER_SIZE 28
+
+// A chunk holds at most this many samples, or stays open at most this long (s)
+#define LOG_CHUNK_SAMPLES 1024
+#define LOG_CHUNK_AGE 10
+
+// The signal log writer writes this much at a time (bytes), and at least this often (s)
+#define LOG_WRITE_SIZE 65536
+#define LOG_FLUSH_INTERVAL 5
+
+// Transmit priority classes, sent in this order before falling back to the id
+#define PRIORITY_HIGH 0
+#define PRIORITY_NORMAL 1
+#define PRIORITY_LOW 2
+
+// How long SendWriteMessages waits for a frame to be acknowledged on the bus (ms)
+#define WRITE_TIMEOUT 100
+
+// How long it waits after flushing a timed out frame, which may already be in arbitration
+// and go out anyway (ms)
+#define WRITE_FLUSH_GRACE 50
+
+// Write statuses besides canlib's
+#define WRITE_SUPERSEDED -1000
+#define WRITE_UNKNOWN_SIGNAL -1001
+
+// Buses, indexes into definitionTable::read
+#define BUS_HS 0
+#define BUS_LS 1
+
+// A definition reader that holds no table, see definitionDomain
+#define DEFINITIONS_OFFLINE ULONG_MAX
+
+// How often replaced definition tables are checked for readers (ms)
+#define RECLAIM_INTERVAL 100
 
 #define IS_SIGNED true
 #define IS_NOT_SIGNED false
@@ -49,10 +159,11 @@ struct signalDef {
     int startBit;
     int length;
     double scale;
-    int offset;
+    double offset;
     string unit;
+    int id; // assigned by the signalRegistry
 
-    signalDef(bool isExtended, string name, bool isSigned, int startBit, int length, double scale, int offset, string unit) :
+    signalDef(bool isExtended, string name, bool isSigned, int startBit, int length, double scale, double offset, string unit) :
     isExtended(isExtended),
     name(name),
     isSigned(isSigned),
@@ -60,7 +171,8 @@ struct signalDef {
     length(length),
     scale(scale),
     offset(offset),
-    unit(unit)  { }
+    unit(unit),
+    id(-1)  { }
 };
 
 struct messageDef {
@@ -68,12 +180,14 @@ struct messageDef {
   unsigned long message;
   int startBit;
   int length;
+  int priority;
 
-  messageDef(long id, unsigned long messageDefault, int startBit, int length) :
+  messageDef(long id, unsigned long messageDefault, int startBit, int length, int priority = PRIORITY_NORMAL) :
     id(id),
     message(messageDefault),
     startBit(startBit),
-    length(length) { }
+    length(length),
+    priority(priority) { }
 };
 
 // Define readSignalMap data structure
@@ -84,11 +198,128 @@ typedef unordered_multimap<int, signalDef> readSignalMap;
 // Keys are strings and values are messageDef types
 typedef unordered_map<string, messageDef> writeMessageMap;
 
+// A signal we can write
+struct writeSignal {
+    string name;
+    int bus;
+    messageDef message;
+};
+
+/*
+  Dense ids for every signal, assigned when the module loads, so the bus threads never
+  copy or hash signal names. Read and write signals have separate ids. The names are
+  kept as persistent V8 strings for the callbacks.
+  Ids are never reused, names added later (by reloadDefinitions or a subscription to a
+  signal that isn't defined yet) get new ones. Read ids are only added with
+  subscriptions.lock held once the bus threads are running.
+*/
+struct signalRegistry {
+    vector<string> names;
+    vector<Persistent<String> > v8Names;
+    unordered_map<string, int> ids;
+
+    vector<string> writeNames;
+    unordered_map<string, int> writeIds;
+};
+
+// Every signal definition in use. Never changed once published, see definitionDomain.
+struct definitionTable {
+    // by bus
+    readSignalMap read[2];
+
+    // by write signal id, with a bus of -1 for ids not defined in this table
+    vector<writeSignal> writes;
+
+    // the epoch it was replaced in
+    unsigned long retiredEpoch;
+};
+
+/*
+  Publishes definition tables to the bus threads, RCU style, so definitions can be reloaded
+  without stopping them. Readers never block: each holds the table only between
+  LoadDefinitions, which records the epoch it loaded at, and DefinitionsOffline.
+  reloadDefinitions swaps in a new table and bumps the epoch, and the old one is freed on
+  the JavaScript thread once no reader can still be holding it.
+*/
+struct definitionDomain {
+    atomic<definitionTable*> current;
+    atomic<unsigned long> epoch;
+
+    // the epoch each bus thread last loaded at, or DEFINITIONS_OFFLINE.
+    // Only added to before the bus threads start
+    vector<atomic<unsigned long>*> readers;
+
+    // replaced tables waiting for their readers, JavaScript thread only
+    vector<definitionTable*> retired;
+    uv_timer_t reclaimTimer;
+};
+
+// The outcome of a write, reported back to JavaScript
+struct writeCompletion {
+    Persistent<Function> callback;
+    int status; // canOK, a canlib error or one of WRITE_*
+    unsigned long timestamp;
+};
+
 // A single signal processed from a message
 struct canSignal {
-    string name;
+    int id; // read or write signal id
     double value;
-    string unit;
+    int sourceAddress; // J1939 source address, -1 on other buses
+    unsigned long timestamp;
+
+    // write side only
+    int priority; // -1 for the message's default
+    writeCompletion* completion;
+};
+
+// A tumbling (slide == window) or sliding window over a signal, both in ms
+struct aggregationDef {
+    unsigned long window;
+    unsigned long slide;
+};
+
+// Statistics for one slide of a window
+struct aggregatePane {
+    unsigned long count;
+    double min;
+    double max;
+    double sum;
+    double integral;
+    double first;
+    double last;
+    unsigned long firstTime;
+    unsigned long lastTime;
+};
+
+// Running state of an aggregation. The window is a ring of window / slide panes,
+// panes[current] being the one that ends at paneStart + slide.
+struct signalAggregator {
+    aggregationDef def;
+    int sourceAddress; // J1939 source address, -1 on other buses
+    vector<aggregatePane> panes;
+    int current;
+    unsigned long paneStart;
+    bool started;
+
+    // previous sample, for integrating across panes
+    double lastValue;
+    unsigned long lastTime;
+};
+
+// The statistics of a signal over one window
+struct signalAggregate {
+    int id;
+    int sourceAddress;
+    unsigned long start;
+    unsigned long end;
+    unsigned long count;
+    double min;
+    double max;
+    double mean;
+    double last;
+    double integral; // value * seconds
+    double rate; // change per second
 };
 
 // The data from a message received
@@ -96,11 +327,76 @@ struct canMessage {
     long id;
     unsigned char data[8];
     unsigned int length;
+    unsigned int flags;
+    unsigned long timestamp;
+
+    // write side only
+    writeCompletion* completion;
+};
+
+// Orders frames waiting to be sent: priority class, then id (lower ids win arbitration),
+// then arrival
+typedef tuple<int, long, unsigned long> transmitKey;
+
+// A frame waiting to be sent and the signal it was written for
+struct pendingFrame {
+    canMessage* message;
+    int signal;
+};
+
+// Frames waiting to be sent on a bus. A write to a signal that already has a frame pending
+// replaces that frame, so only the latest value goes out.
+struct transmitScheduler {
+    map<transmitKey, pendingFrame> pending;
+    unordered_map<int, transmitKey> pendingBySignal;
+    unsigned long sequence;
+
+    // synchronization
+    uv_mutex_t lock;
+    uv_cond_t notEmpty;
+};
+
+// Writes that finished, waiting for their callbacks to run in the V8 thread
+struct writeCompletionQueue {
+    queue<writeCompletion*> completions;
+    uv_mutex_t lock;
+    uv_async_t async;
+};
+
+// A J1939 multi-packet message (BAM or RTS/CTS) being reassembled
+struct j1939Session {
+    int pgn;
+    unsigned int totalLength;
+    unsigned int totalPackets;
+    unsigned int nextPacket;
+    unsigned long lastTimestamp;
+    vector<unsigned char> data;
+};
+
+// Data to pass to ExecuteCallbacks, shared by both processing threads
+struct canReadCallbackBaton {
+    // callback functions and the object they are called on
+    Persistent<Function> callback;
+    Persistent<Function> aggregateCallback;
+    Persistent<Object> context;
+
+    // processed side synchronization
+    queue<canSignal*>* processedReadQueue;
+    queue<signalAggregate*>* processedAggregateQueue;
+    uv_mutex_t* processedReadQueueLock;
+    uv_async_t* processedReadAsync;
 };
 
 // Data to pass to ReadMessages
 struct canReadBaton {
-    readSignalMap signalDefinitions;
+    int bus;
+    int idFormat;
+
+    // subscribed subset of the bus's definitions, and the epoch they're from
+    readSignalMap activeDefinitions;
+    unsigned int subscriptionVersion;
+    unsigned long definitionsEpoch;
+    atomic<unsigned long>* definitionsReader;
 
     // bus params
     int channel;
@@ -120,42 +416,49 @@ struct canReadBaton {
 
 // Data to pass to ProcessMessages
 struct canProcessReadBaton {
-    readSignalMap signalDefinitions;
+    int bus;
+    int idFormat;
+
+    // subscribed subset of the bus's definitions, and the epoch they're from
+    readSignalMap activeDefinitions;
+    unsigned int subscriptionVersion;
+    unsigned long definitionsEpoch;
+    atomic<unsigned long>* definitionsReader;
+
+    // J1939 transport sessions keyed by (source address << 8 | destination address)
+    unordered_map<int, j1939Session> j1939Sessions;
+
+    // where decoded signals go, NULL until start
+    canReadCallbackBaton* callbacks;
+
+    // signals passed on one by one by signal id, and the aggregated ones. J1939 nodes are
+    // aggregated separately, by signal id << 9 | source address + 1
+    vector<bool> deliveredSignals;
+    unordered_map<int, aggregationDef> aggregations;
+    unordered_map<int, signalAggregator*> aggregators;
+
+    // signals being logged by read id
+    vector<bool> loggedSignals;
+    bool logging;
 
     // read side synchronization
     queue<canMessage*>* readQueue;
     uv_mutex_t* readQueueLock;
     uv_cond_t* readQueueNotEmpty;
-
-    // processed side synchronization
-    queue<canSignal*>* processedReadQueue;
-    uv_mutex_t* processedReadQueueLock;
-    uv_async_t* processedReadAsync;
-};
-
-// Data to pass to ExecuteCallbacks
-struct canReadCallbackBaton {
-    // callback function
-    Persistent<Function> callback;
-
-    // synchronization
-    queue<canSignal*>* processedReadQueue;
-    uv_mutex_t* processedReadQueueLock;
 };
 
 // Data to pass to WriteMessages
 struct canProcessWriteBaton {
-    writeMessageMap messageDefinitions;
+    int bus;
+    atomic<unsigned long>* definitionsReader;
 
     // synchronization from javascript
     queue<canSignal*>* writeQueue;
     uv_mutex_t* writeQueueLock;
     uv_cond_t* writeQueueNotEmpty;
 
-    // processed side synchronization
-    queue<canMessage*>* processedWriteQueue;
-    uv_mutex_t* processedWriteQueueLock;
-    uv_cond_t* processedWriteQueueNotEmpty;
+    // processed side
+    transmitScheduler* scheduler;
 };
 
 struct canWriteBaton {
@@ -169,13 +472,224 @@ struct canWriteBaton {
     int syncMode;
     int canFlags;
 
-    // synchronization
-    queue<canMessage*>* processedWriteQueue;
-    uv_mutex_t* processedWriteQueueLock;
-    uv_cond_t* processedWriteQueueNotEmpty;
+    // frames to send
+    transmitScheduler* scheduler;
+};
+
+// Data to pass to ExecuteRawTapCallback
+struct rawTapCallbackBaton {
+    Persistent<Function> callback;
+    Persistent<Object> context;
+    bool includeTx;
+};
+
+/*
+  A ring of every frame on the buses, shared with JavaScript as a Buffer.
+  The header holds the write cursor (frames written so far, wrapping at 2^32), the number
+  of records and the record size, as little endian uint32s. Each record holds the id
+  (uint32), driver timestamp (uint32), flags (uint32), dlc (uint8), channel (uint8, or'ed
+  with RAW_TAP_TX for frames we sent), two bytes of padding and the 8 data bytes.
+  The bus threads never wait for JavaScript, which keeps its own read cursor and is woken
+  at most once per batch.
+*/
+struct rawFrameTap {
+    char* memory;
+
+    // whether frames we send are copied in, while any of txOpeners asked for them
+    bool includeTx;
+    int txOpeners;
+
+    // between the bus threads writing records
+    uv_mutex_t lock;
+
+    // one async per openRawTap, guarded by lock
+    vector<uv_async_t*> asyncs;
+};
+
+// The timing of one id on a bus, see busAnalyzer
+struct idTiming {
+    long id;
+    bool isExtended;
+
+    // kept across snapshots
+    bool seen;
+    unsigned long last;
+    double expectedPeriod;
+    int latePeriods;
+
+    // since the last snapshot
+    unsigned long count;
+    unsigned long periods;
+    double minPeriod;
+    double maxPeriod;
+    double sumPeriods;
+    double sumSquaredPeriods;
+    unsigned long missing;
+};
+
+/*
+  Measures the frames ReadMessages sees on one bus, using driver timestamps.
+  Ids find their idTiming through flat slot tables, standard ids directly and extended ids
+  by open addressing, so no map is searched per frame. Ids past ANALYZER_MAX_IDS are only
+  counted towards the bus load.
+*/
+struct busAnalyzer {
+    // idTiming index + 1 by standard id, 0 for ids not seen yet
+    vector<unsigned short> stdSlots;
+
+    // idTiming index + 1 and id by bucket
+    vector<unsigned short> extSlots;
+    vector<long> extIds;
+
+    vector<idTiming> timings;
+
+    // since the last snapshot
+    bool started;
+    unsigned long start;
+    unsigned long frames;
+    unsigned long errorFrames;
+    unsigned long untracked;
+    double bits;
+};
+
+// One id's part of a busSnapshot
+struct idStats {
+    long id;
+    bool isExtended;
+    unsigned long count;
+    double rate;
+    double minPeriod;
+    double maxPeriod;
+    double meanPeriod;
+    double jitter;
+    unsigned long missing;
+    bool stalled;
+    unsigned long lastSeen;
+};
+
+// What a busAnalyzer measured between start and end (driver time, ms)
+struct busSnapshot {
+    int bus;
+    unsigned long start;
+    unsigned long end;
+    unsigned long frames;
+    unsigned long errorFrames;
+    unsigned long untracked;
+    double load;
+    vector<idStats> ids;
+};
+
+// Snapshots from the bus threads waiting for JavaScript
+struct busSnapshotQueue {
+    Persistent<Function> callback;
+    queue<busSnapshot*> snapshots;
+    uv_mutex_t lock;
+    uv_async_t async;
+};
+
+// Packs bit fields into bytes, most significant bit first
+struct bitWriter {
+    string bytes;
+    int free; // unused bits in the last byte
+};
+
+// Reads back what a bitWriter wrote
+struct bitReader {
+    const unsigned char* data;
+    size_t length;
+    size_t bit;
+};
+
+/*
+  The open chunk of one signal (from one source address) in a signal log.
+  Timestamps are stored as delta-of-deltas of the driver timestamps after the chunk's
+  first time, values as the XOR of each double with the one before it.
+*/
+struct chunkEncoder {
+    int signal;
+    int sourceAddress;
+    unsigned long count;
+    time_t opened;
+
+    // time of the first sample (driver time plus the log's offset, ms since the epoch)
+    long long firstTime;
+    unsigned long lastTimestamp;
+    long long lastDelta;
+
+    uint64_t lastValue;
+    int lastLeading;
+    int lastTrailing;
+
+    bitWriter times;
+    bitWriter values;
 };
 
-Persistent<Object> context;  
+/*
+  Logs decoded signals to a file for the long term. The processing threads compress
+  samples into per-signal chunks and a writer thread writes them out in large sequential
+  writes. The file starts with LOG_MAGIC and holds records, little endian:
+    name:  'N', 0, uint16 signal id, uint16 name length, the name
+    chunk: 'C', 0, uint16 signal id, int16 source address, uint16 0, uint32 sample count,
+           int64 first time (ms since the epoch), uint32 timestamp bytes,
+           uint32 value bytes, the timestamps, the values
+  A signal's name record comes before its chunks. Everything is guarded by logLock.
+*/
+struct signalLogger {
+    int fd;
+
+    // added to each bus's driver timestamps for ms since the epoch, taken once by startLog
+    long long timeOffset[2];
+
+    // open chunks by signal id << 9 | source address + 1
+    unordered_map<int, chunkEncoder*> encoders;
+
+    // records waiting for the writer thread
+    string pending;
+    bool stopping;
+
+    uv_thread_t writer;
+};
+
+// Listeners or pollers in JavaScript per signal id, the signals aggregated natively, and the
+// callbacks they go to (NULL until start). version is bumped on every change so the bus
+// threads know to rebuild their active definitions.
+struct signalSubscriptions {
+    vector<int> counts;
+    unordered_map<int, aggregationDef> aggregations;
+    canReadCallbackBaton* callbacks;
+    uv_mutex_t lock;
+    atomic<unsigned int> version;
+};
+
+signalSubscriptions subscriptions;
+
+// The bus threads are started once, by start or startLog
+bool busThreadsStarted = false;
+
+// NULL while no one has the raw frame tap open
+atomic<rawFrameTap*> rawTap(NULL);
+
+// Allocated by the first openRawTap and kept for the Buffers over it, V8 thread only
+rawFrameTap* rawTapStorage = NULL;
+
+// How often the bus analyzers take a snapshot (ms), 0 while they're off
+atomic<unsigned long> analyzerInterval(0);
+
+busSnapshotQueue busSnapshots;
+
+// The open signal log, or NULL
+signalLogger* logger = NULL;
+uv_mutex_t logLock;
+uv_cond_t logNotEmpty;
+
+// Logged signals by read id, guarded by subscriptions.lock
+vector<bool> loggedSignals;
+
+writeCompletionQueue writeCompletions;
+
+signalRegistry registry;
+
+definitionDomain definitions;
 
 // Global ls write queue and synchronization
 queue<canSignal*>* lsWriteQueue;
@@ -232,30 +746,59 @@ readSignalMap createLsReadSignalMap() {
   return m;
 }
 
+// Creates a readSignalMap for the heavy-duty J1939 bus
+// Keys are PGNs and start bits count from the lsb of the first data byte (J1939 byte order)
+readSignalMap createJ1939ReadSignalMap() {
+
+  readSignalMap m = {
+    // EEC1
+    {0xF004, signalDef(IS_EXTENDED, "engineTorque", IS_NOT_SIGNED, 16, 8, 1, -125, "%")},
+    {0xF004, signalDef(IS_EXTENDED, "engineRpm", IS_NOT_SIGNED, 24, 16, 0.125, 0, "rpm")},
+
+    // CCVS
+    {0xFEF1, signalDef(IS_EXTENDED, "vehicleSpeed", IS_NOT_SIGNED, 8, 16, 1.0/256, 0, "km / h")},
+
+    // ET1
+    {0xFEEE, signalDef(IS_EXTENDED, "engineTemp", IS_NOT_SIGNED, 0, 8, 1, -40, "Deg C")},
+
+    // LFE
+    {0xFEF2, signalDef(IS_EXTENDED, "fuelConsumption", IS_NOT_SIGNED, 0, 16, 0.05, 0, "L/hr")},
+
+    // VEP1
+    {0xFEF7, signalDef(IS_EXTENDED, "batteryPotential", IS_NOT_SIGNED, 48, 16, 0.05, 0, "V")},
+
+    // DM1 (sent as a BAM when more than one DTC is active)
+    {0xFECA, signalDef(IS_EXTENDED, "amberWarningLamp", IS_NOT_SIGNED, 2, 2, 1, 0, "")},
+    {0xFECA, signalDef(IS_EXTENDED, "malfunctionLamp", IS_NOT_SIGNED, 6, 2, 1, 0, "")},
+  };
+
+  return m;
+}
+
 writeMessageMap createLsWriteMessageMap() {
   writeMessageMap m = {
 
     {"diagnosticMode", messageDef(0x101, (unsigned long) 0x000000003E01FE07, -1, 8)},
 
-    {"toggleAc", messageDef(0x251, (unsigned long) 0x000000010104AE07, -1, 8)},
+    {"toggleAc", messageDef(0x251, (unsigned long) 0x000000010104AE07, -1, 8, PRIORITY_LOW)},
 
-    {"toggleAutoTemp", messageDef(0x251, (unsigned long) 0x000000080804AE07, -1, 8)},
+    {"toggleAutoTemp", messageDef(0x251, (unsigned long) 0x000000080804AE07, -1, 8, PRIORITY_LOW)},
 
-    {"toggleRecirculate", messageDef(0x251, (unsigned long) 0x000000040404AE07, -1, 8)},
+    {"toggleRecirculate", messageDef(0x251, (unsigned long) 0x000000040404AE07, -1, 8, PRIORITY_LOW)},
 
-    {"toggleRearDefrost", messageDef(0x251, (unsigned long) 0x000000101004AE07, -1, 8)},
+    {"toggleRearDefrost", messageDef(0x251, (unsigned long) 0x000000101004AE07, -1, 8, PRIORITY_LOW)},
 
-    {"toggleDefrost", messageDef(0x251, (unsigned long) 0x000101000004AE07, -1, 8)},
+    {"toggleDefrost", messageDef(0x251, (unsigned long) 0x000101000004AE07, -1, 8, PRIORITY_LOW)},
 
-    {"toggleTopVent", messageDef(0x251, (unsigned long) 0x000000404004AE07, -1, 8)},
+    {"toggleTopVent", messageDef(0x251, (unsigned long) 0x000000404004AE07, -1, 8, PRIORITY_LOW)},
 
-    {"toggleFloorVent", messageDef(0x251, (unsigned long) 0x000000808004AE07, -1, 8)},
+    {"toggleFloorVent", messageDef(0x251, (unsigned long) 0x000000808004AE07, -1, 8, PRIORITY_LOW)},
 
-    {"ventFanSpeed", messageDef(0x251, (unsigned long) 0x000000000802AE07, 56, 8)},
+    {"ventFanSpeed", messageDef(0x251, (unsigned long) 0x000000000802AE07, 56, 8, PRIORITY_LOW)},
 
-    {"driverTemp", messageDef(0x251, (unsigned long) 0x000000000102AE07, 32, 8)},
+    {"driverTemp", messageDef(0x251, (unsigned long) 0x000000000102AE07, 32, 8, PRIORITY_LOW)},
 
-    {"passengerTemp", messageDef(0x251, (unsigned long) 0x000000000202AE07, 32, 8)}
+    {"passengerTemp", messageDef(0x251, (unsigned long) 0x000000000202AE07, 32, 8, PRIORITY_LOW)}
   };
 
   return m;
@@ -264,22 +807,23 @@ writeMessageMap createLsWriteMessageMap() {
 writeMessageMap createHsWriteMessageMap() {
   writeMessageMap m = {
 
-    {"hvacCommand", messageDef(0x7A0, (unsigned long) 0x00, 0, 1)}
+    {"hvacCommand", messageDef(0x7A0, (unsigned long) 0x00, 0, 1, PRIORITY_LOW)}
   };
 
   return m;
 }
 
-// Takes a value and string of a message
+// Takes a message definition and a value
 // Returns a canMessage struct with an updated byte value to be written
-canMessage* WriteParse(writeMessageMap m, string name, unsigned long value) {
+canMessage* WriteParse(const messageDef& definition, unsigned long value) {
   canMessage* c = new canMessage;
-  int startBit = m.at(name).startBit;
-  c->id = m.at(name).id;
-  c->length = m.at(name).length;
-  unsigned long message = m.at(name).message;
-  if (startBit != -1) {
-    message = (message + (value << startBit));
+  c->flags = canMSG_STD;
+  c->completion = NULL;
+  c->id = definition.id;
+  c->length = definition.length;
+  unsigned long message = definition.message;
+  if (definition.startBit != -1) {
+    message = (message + (value << definition.startBit));
   }
   for (int i = 0; i < (int) c->length; i++) {
     c->data[i] = (unsigned char)message;
@@ -288,10 +832,126 @@ canMessage* WriteParse(writeMessageMap m, string name, unsigned long value) {
   return c;
 }
 
+// Returns the id of a read signal name, registering it if it's new
+int InternReadSignal(const string& name) {
+  auto id = registry.ids.find(name);
+  if (id == registry.ids.end()) {
+    id = registry.ids.insert(make_pair(name, (int) registry.names.size())).first;
+    registry.names.push_back(name);
+    registry.v8Names.push_back(Persistent<String>::New(String::NewSymbol(name.c_str())));
+  }
+  return id->second;
+}
+
+// Gives every signal in a readSignalMap its registry id
+void RegisterReadSignals(readSignalMap& m) {
+  for (auto it = m.begin(); it != m.end(); ++it) {
+    it->second.id = InternReadSignal(it->second.name);
+  }
+}
+
+// Adds the signals of a writeMessageMap for a bus to a table, registering new names
+void RegisterWriteSignals(definitionTable* table, const writeMessageMap& m, int bus) {
+  for (auto it = m.begin(); it != m.end(); ++it) {
+    auto id = registry.writeIds.find(it->first);
+    if (id == registry.writeIds.end()) {
+      id = registry.writeIds.insert(make_pair(it->first, (int) registry.writeNames.size())).first;
+      registry.writeNames.push_back(it->first);
+    }
+    if ((int) table->writes.size() <= id->second) {
+      writeSignal undefined = { "", -1, messageDef(0, 0, -1, 0) };
+      table->writes.resize(id->second + 1, undefined);
+    }
+    writeSignal w = { it->first, bus, it->second };
+    table->writes[id->second] = w;
+  }
+}
+
+// Builds a table of the definitions in this file
+definitionTable* BuiltinDefinitions() {
+  definitionTable* table = new definitionTable;
+#if HS_ID_FORMAT == ID_FORMAT_J1939
+  table->read[BUS_HS] = createJ1939ReadSignalMap();
+#else
+  table->read[BUS_HS] = createHsReadSignalMap();
+#endif
+  table->read[BUS_LS] = createLsReadSignalMap();
+  RegisterReadSignals(table->read[BUS_HS]);
+  RegisterReadSignals(table->read[BUS_LS]);
+  RegisterWriteSignals(table, createHsWriteMessageMap(), BUS_HS);
+  RegisterWriteSignals(table, createLsWriteMessageMap(), BUS_LS);
+  return table;
+}
+
+// Registers a bus thread as a reader of the definitions
+atomic<unsigned long>* AddDefinitionReader() {
+  atomic<unsigned long>* reader = new atomic<unsigned long>(DEFINITIONS_OFFLINE);
+  definitions.readers.push_back(reader);
+  return reader;
+}
+
+// Returns the current definitions, which the reader may use until DefinitionsOffline
+definitionTable* LoadDefinitions(atomic<unsigned long>* reader) {
+  reader->store(definitions.epoch.load());
+  return definitions.current.load();
+}
+
+// Lets go of the definitions loaded by a reader
+void DefinitionsOffline(atomic<unsigned long>* reader) {
+  reader->store(DEFINITIONS_OFFLINE);
+}
+
+// Frees the replaced tables no reader can still be holding, stopping once there are none
+void ReclaimDefinitions(uv_timer_t* handle, int status /*UNUSED*/) {
+  unsigned long oldest = DEFINITIONS_OFFLINE;
+  for (auto it = definitions.readers.begin(); it != definitions.readers.end(); ++it) {
+    oldest = min(oldest, (*it)->load());
+  }
+
+  for (auto it = definitions.retired.begin(); it != definitions.retired.end();) {
+    if ((*it)->retiredEpoch <= oldest) {
+      delete *it;
+      it = definitions.retired.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  if (definitions.retired.empty()) {
+    uv_timer_stop(&definitions.reclaimTimer);
+  }
+}
+
+// Swaps in a new definition table. Must be called in the V8 thread
+void PublishDefinitions(definitionTable* table) {
+  definitionTable* old = definitions.current.exchange(table);
+  old->retiredEpoch = ++definitions.epoch;
+  definitions.retired.push_back(old);
+
+  ReclaimDefinitions(&definitions.reclaimTimer, 0);
+  if (!definitions.retired.empty()) {
+    uv_timer_start(&definitions.reclaimTimer, ReclaimDefinitions, RECLAIM_INTERVAL, RECLAIM_INTERVAL);
+  }
+}
+
+// Sign extends, scales and offsets a raw signal value
+double ScaleSignal(const signalDef& ourSignal, long tempSignal) {
+
+    // If the signal is signed and negative, move the signed bit to the end (e.g. with length 6, 0b0...00101010 becomes 0b1...11101010)
+    if (ourSignal.isSigned && tempSignal >> (ourSignal.length - 1) != 0) {
+      tempSignal = (tempSignal | -1 << ourSignal.length);
+    }
+
+    // Scale and offset signal
+    double signal = (double) tempSignal;
+    signal *= ourSignal.scale;
+    signal += ourSignal.offset;
+    return signal;
+}
+
 // Takes an id and byte array and prints out the corresponding signal definitions
-vector<canSignal*> ReadParse(readSignalMap m, unsigned long id, unsigned char message[], unsigned int length) {
+vector<canSignal*> ReadParse(const readSignalMap& m, unsigned long id, unsigned char message[], unsigned int length) {
   unsigned long mask;
-  double signal;
   unsigned long data = 0;
   vector<canSignal*> signals;
 
@@ -303,91 +963,1237 @@ vector<canSignal*> ReadParse(readSignalMap m, unsigned long id, unsigned char me
   // Parse out each of the signals
   auto range = m.equal_range(id);
   for (auto it = range.first; it != range.second; ++it) {
-    signalDef ourSignal = it->second;
+    const signalDef& ourSignal = it->second;
 
     // Mask out our signal
     mask = ((1l << ourSignal.length) - 1) << ourSignal.startBit;
     long tempSignal = (data & mask) >> ourSignal.startBit;
 
-    // If the signal is signed and negative, move the signed bit to the end (e.g. with length 6, 0b0...00101010 becomes 0b1...11101010)
-    if (ourSignal.isSigned && tempSignal >> (ourSignal.length - 1) != 0) {
-      tempSignal = (tempSignal | -1 << ourSignal.length);
-    }
-
-    // Scale and offset signal
-    signal = (double) tempSignal;
-    signal *= ourSignal.scale;
-    signal += ourSignal.offset;
-
     // Create canSignal
     canSignal* cSig = new canSignal;
-    cSig->name = ourSignal.name;
-    cSig->value = signal;
-    cSig->unit = ourSignal.unit;
+    cSig->id = ourSignal.id;
+    cSig->value = ScaleSignal(ourSignal, tempSignal);
+    cSig->sourceAddress = -1;
     signals.push_back(cSig);
   }
 
   return signals;
 }
 
-/*
-  Fires the callback function for each signal in the processedQueue.
-  This function should be signaled via the async when a signal is added to the processedQueue.
-  This function must run in the V8 thread
-*/
-void ExecuteCallbacks(uv_async_t* handle, int status /*UNUSED*/) {
-
-    // Retrieve baton
-    canReadCallbackBaton* baton = (canReadCallbackBaton*) handle->data;
+// Returns the PGN of a 29 bit J1939 id, dropping the priority and source address.
+// PDU1 PGNs (PF < 240) are addressed, so the destination byte is dropped too.
+int J1939Pgn(long id) {
+  int pgn = (id >> 8) & 0x3FFFF;
+  if (((pgn >> 8) & 0xFF) < 240) {
+    pgn &= 0x3FF00;
+  }
+  return pgn;
+}
 
-    // Lock the processedQueue
-    uv_mutex_lock(baton->processedReadQueueLock);
+int J1939SourceAddress(long id) {
+  return id & 0xFF;
+}
 
-    // Run until it is empty
-    while (!baton->processedReadQueue->empty()) {
+// Returns the destination of a PDU1 id or the global address for PDU2 (broadcast) ids
+int J1939DestinationAddress(long id) {
+  if (((id >> 16) & 0xFF) < 240) {
+    return (id >> 8) & 0xFF;
+  }
+  return J1939_GLOBAL_ADDRESS;
+}
 
-        // Dequeue a signal
-        canSignal* s = baton->processedReadQueue->front();
-        baton->processedReadQueue->pop();
+// Takes a PGN and J1939 payload (single frame or reassembled) and returns the decoded signals.
+// Signals are little endian with start bits counted from the lsb of the first byte.
+vector<canSignal*> J1939Parse(const readSignalMap& m, int pgn, int sourceAddress, const unsigned char message[], unsigned int length) {
+  vector<canSignal*> signals;
 
-        // Let others access the queue while we callback
-        uv_mutex_unlock(baton->processedReadQueueLock);
+  auto range = m.equal_range(pgn);
+  for (auto it = range.first; it != range.second; ++it) {
+    const signalDef& ourSignal = it->second;
 
-        // Callback to the JS
-        const unsigned argc = 2;
-        Local<Value> argv[argc] = {
-            Local<Value>::New(String::New(s->name.c_str())),
-            Local<Value>::New(Number::New(s->value))
-        };
-        TryCatch tryCatch;
-        baton->callback->Call(context, argc, argv);
-        if (tryCatch.HasCaught()) {
-            node::FatalException(tryCatch);
-        }
+    // Skip signals that don't fit in this message (e.g. a short DM1)
+    int endBit = ourSignal.startBit + ourSignal.length;
+    if (endBit > (int) length * 8) {
+      continue;
+    }
 
-        // Clean up
-        delete s;
+    unsigned long data = 0;
+    for (int i = (endBit - 1) / 8; i >= ourSignal.startBit / 8; i--) {
+      data = (data << 8) | message[i];
+    }
+    unsigned long mask = (1l << ourSignal.length) - 1;
+    long tempSignal = (data >> (ourSignal.startBit % 8)) & mask;
 
-        // Regain the lock before looping again
-        uv_mutex_lock(baton->processedReadQueueLock);
+    // All ones means "not available" in J1939
+    if ((unsigned long) tempSignal == mask) {
+      continue;
     }
 
-    // We are all finished with the queue, so let others fill it up
-    uv_mutex_unlock(baton->processedReadQueueLock);
+    canSignal* cSig = new canSignal;
+    cSig->id = ourSignal.id;
+    cSig->value = ScaleSignal(ourSignal, tempSignal);
+    cSig->sourceAddress = sourceAddress;
+    signals.push_back(cSig);
+  }
+
+  return signals;
+}
+
+// Returns the key a received id is looked up by in a readSignalMap
+long ReadSignalKey(int idFormat, long id, unsigned int flags) {
+  if (!(flags & canMSG_EXT)) {
+    return id;
+  }
+  if (idFormat == ID_FORMAT_J1939) {
+    return J1939Pgn(id);
+  }
+  long mask = ((1 << 16) - 1) << 13;
+  return id & mask;
 }
 
 /*
-  Constantly reads messages from a CAN bus using the baton's params (never exiting).
-  Pushes messages onto the baton's readQueue.
-  req->data should be a canReadBaton.
-  Does not need to run in the V8 thread.
+  Rebuilds active from the subscribed signals in the bus's definitions if the subscriptions
+  changed since version, or the definitions since epoch. Returns true if active was rebuilt.
 */
-void ReadMessages(void* arg) {
+bool RefreshActiveDefinitions(int bus, atomic<unsigned long>* reader, unsigned long& epoch,
+                              readSignalMap& active, unsigned int& version) {
+  if (subscriptions.version.load() == version && definitions.epoch.load() == epoch) {
+    return false;
+  }
 
-    // Retrieve baton
-    canReadBaton* baton = (canReadBaton*) arg;
+  definitionTable* table = LoadDefinitions(reader);
+  epoch = reader->load();
+
+  uv_mutex_lock(&subscriptions.lock);
+  active.clear();
+  for (auto it = table->read[bus].begin(); it != table->read[bus].end(); ++it) {
+    int id = it->second.id;
+    if ((id < (int) loggedSignals.size() && loggedSignals[id]) ||
+        (id < (int) subscriptions.counts.size() && subscriptions.counts[id] > 0) ||
+        subscriptions.aggregations.count(id) != 0) {
+      active.insert(*it);
+    }
+  }
+  version = subscriptions.version.load();
+  uv_mutex_unlock(&subscriptions.lock);
 
-    canHandle handle = canOpenChannel(baton->channel, baton->canFlags);
+  DefinitionsOffline(reader);
+
+  return true;
+}
+
+/*
+  Same as RefreshActiveDefinitions, also rebuilding which signals are passed on and
+  which are aggregated. Aggregations that didn't change keep their state.
+*/
+void RefreshProcessing(canProcessReadBaton* baton) {
+  if (!RefreshActiveDefinitions(baton->bus, baton->definitionsReader, baton->definitionsEpoch,
+                                baton->activeDefinitions, baton->subscriptionVersion)) {
+    return;
+  }
+
+  uv_mutex_lock(&subscriptions.lock);
+
+  baton->loggedSignals.assign(registry.names.size(), false);
+  baton->logging = false;
+  for (size_t id = 0; id < loggedSignals.size(); id++) {
+    baton->loggedSignals[id] = loggedSignals[id];
+    baton->logging = baton->logging || loggedSignals[id];
+  }
+
+  baton->callbacks = subscriptions.callbacks;
+
+  baton->deliveredSignals.assign(registry.names.size(), false);
+  for (size_t id = 0; id < subscriptions.counts.size(); id++) {
+    baton->deliveredSignals[id] = subscriptions.counts[id] > 0;
+  }
+
+  // Aggregators start with their first sample
+  baton->aggregations = subscriptions.aggregations;
+  for (auto it = baton->aggregators.begin(); it != baton->aggregators.end();) {
+    auto def = baton->aggregations.find(it->first >> 9);
+    if (def == baton->aggregations.end() ||
+        def->second.window != it->second->def.window || def->second.slide != it->second->def.slide) {
+      delete it->second;
+      it = baton->aggregators.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  uv_mutex_unlock(&subscriptions.lock);
+}
+
+void ResetPane(aggregatePane& pane) {
+  pane.count = 0;
+  pane.sum = 0;
+  pane.integral = 0;
+}
+
+// Returns the statistics over all panes of the aggregator, or NULL if it has no samples
+signalAggregate* MergeWindow(signalAggregator* a, int id) {
+  signalAggregate* r = NULL;
+  double sum = 0;
+  double integral = 0;
+  double first = 0;
+  unsigned long firstTime = 0;
+  unsigned long lastTime = 0;
+
+  // Walk from the oldest pane to the newest
+  for (size_t i = 1; i <= a->panes.size(); i++) {
+    const aggregatePane& pane = a->panes[(a->current + i) % a->panes.size()];
+
+    // Panes without samples still hold the last value
+    integral += pane.integral;
+    if (pane.count == 0) {
+      continue;
+    }
+
+    if (r == NULL) {
+      r = new signalAggregate;
+      r->id = id;
+      r->sourceAddress = a->sourceAddress;
+      r->end = a->paneStart + a->def.slide;
+      r->start = r->end > a->def.window ? r->end - a->def.window : 0;
+      r->count = 0;
+      r->min = pane.min;
+      r->max = pane.max;
+      first = pane.first;
+      firstTime = pane.firstTime;
+    }
+    r->count += pane.count;
+    r->min = min(r->min, pane.min);
+    r->max = max(r->max, pane.max);
+    r->last = pane.last;
+    sum += pane.sum;
+    lastTime = pane.lastTime;
+  }
+
+  if (r != NULL) {
+    r->mean = sum / r->count;
+    r->integral = integral;
+    r->rate = lastTime > firstTime ? (r->last - first) * 1000 / (lastTime - firstTime) : 0;
+  }
+  return r;
+}
+
+/*
+  Finishes every window of the aggregator that ended by t (driver time) and adds them to
+  results. The integral runs up to the end of each window holding the last value, so a gap
+  in the signal is spread over the windows it spans.
+*/
+void CloseWindows(signalAggregator* a, int id, unsigned long t, vector<signalAggregate*>& results) {
+  size_t advanced = 0;
+  while (t >= a->paneStart + a->def.slide) {
+    unsigned long end = a->paneStart + a->def.slide;
+    a->panes[a->current].integral += a->lastValue * (end - a->lastTime) / 1000.0;
+    a->lastTime = end;
+
+    signalAggregate* r = MergeWindow(a, id);
+    if (r != NULL) {
+      results.push_back(r);
+    }
+
+    a->current = (a->current + 1) % a->panes.size();
+    ResetPane(a->panes[a->current]);
+    a->paneStart = end;
+
+    // After a whole window there is nothing left to finish
+    if (++advanced >= a->panes.size()) {
+      a->paneStart = t - t % a->def.slide;
+      a->lastTime = a->paneStart;
+      break;
+    }
+  }
+}
+
+/*
+  Adds a sample to an aggregator. Windows end on multiples of the slide, and a window is
+  finished (and added to results) by the first sample or tick past its end.
+*/
+void AggregateSample(signalAggregator* a, const canSignal* s, vector<signalAggregate*>& results) {
+  unsigned long t = s->timestamp;
+
+  if (!a->started) {
+    a->paneStart = t - t % a->def.slide;
+    a->lastTime = t;
+    a->lastValue = s->value;
+    a->started = true;
+    for (auto it = a->panes.begin(); it != a->panes.end(); ++it) {
+      ResetPane(*it);
+    }
+  }
+
+  // Finish every window that ended before this sample
+  CloseWindows(a, s->id, t, results);
+
+  aggregatePane& pane = a->panes[a->current];
+  if (pane.count == 0) {
+    pane.min = s->value;
+    pane.max = s->value;
+    pane.first = s->value;
+    pane.firstTime = t;
+  } else {
+    pane.min = min(pane.min, s->value);
+    pane.max = max(pane.max, s->value);
+  }
+  pane.count++;
+  pane.sum += s->value;
+  pane.last = s->value;
+  pane.lastTime = t;
+
+  // Trapezoidal integration from the previous sample, or the start of the pane
+  pane.integral += (s->value + a->lastValue) / 2 * (t - a->lastTime) / 1000.0;
+  a->lastValue = s->value;
+  a->lastTime = t;
+}
+
+/*
+  Sets the channel's acceptance filters to the narrowest code/mask pairs that pass every
+  subscribed id, or opens them up while the raw frame tap is open or the bus is analyzed.
+  There is one pair per frame format, so ids we don't want can still get through, those
+  are dropped in ReadMessages.
+*/
+void UpdateAcceptanceFilter(canHandle handle, canReadBaton* baton) {
+  long stdCode = -1, stdMask = 0x7FF;
+  long extCode = -1, extMask = 0x1FFFFFFF;
+
+  // The raw frame tap and the bus analyzer want the whole bus
+  if (rawTap.load() != NULL || analyzerInterval.load() != 0) {
+    canAccept(handle, 0, canFILTER_SET_CODE_STD);
+    canAccept(handle, 0, canFILTER_SET_MASK_STD);
+    canAccept(handle, 0, canFILTER_SET_CODE_EXT);
+    canAccept(handle, 0, canFILTER_SET_MASK_EXT);
+    return;
+  }
+
+  for (auto it = baton->activeDefinitions.begin(); it != baton->activeDefinitions.end(); ++it) {
+    long id = it->first;
+    long significant = 0x7FF;
+
+    if (it->second.isExtended && baton->idFormat == ID_FORMAT_J1939) {
+      significant = ((id >> 8) & 0xFF) < 240 ? 0x3FF0000 : 0x3FFFF00;
+      id = id << 8;
+    } else if (it->second.isExtended) {
+      significant = ((1 << 16) - 1) << 13;
+    }
+
+    long& code = it->second.isExtended ? extCode : stdCode;
+    long& mask = it->second.isExtended ? extMask : stdMask;
+    if (code == -1) {
+      code = id;
+    }
+    mask &= significant & ~(code ^ id);
+  }
+
+  // J1939 transfers can carry any subscribed PGN
+  if (baton->idFormat == ID_FORMAT_J1939 && extCode != -1) {
+    extMask &= 0x3FF0000 & ~(extCode ^ (J1939_PGN_TP_CM << 8)) & ~(extCode ^ (J1939_PGN_TP_DT << 8));
+  }
+
+  // Nothing subscribed, only let the last id through
+  if (stdCode == -1) {
+    stdCode = 0x7FF;
+  }
+  if (extCode == -1) {
+    extCode = 0x1FFFFFFF;
+  }
+
+  canAccept(handle, stdCode & stdMask, canFILTER_SET_CODE_STD);
+  canAccept(handle, stdMask, canFILTER_SET_MASK_STD);
+  canAccept(handle, extCode & extMask, canFILTER_SET_CODE_EXT);
+  canAccept(handle, extMask, canFILTER_SET_MASK_EXT);
+}
+
+/*
+  Handles a J1939 frame, reassembling BAM and RTS/CTS transfers.
+  Returns the decoded signals, which are empty until a transfer completes.
+  Transfers are followed passively, we never answer an RTS ourselves.
+*/
+vector<canSignal*> J1939Process(canProcessReadBaton* baton, canMessage* m) {
+  int pgn = J1939Pgn(m->id);
+  int sourceAddress = J1939SourceAddress(m->id);
+  int destinationAddress = J1939DestinationAddress(m->id);
+  int sessionKey = sourceAddress << 8 | destinationAddress;
+  vector<canSignal*> signals;
+
+  if (pgn == J1939_PGN_TP_CM && m->length == 8) {
+    int control = m->data[0];
+
+    if (control == J1939_TP_CM_BAM || control == J1939_TP_CM_RTS) {
+      unsigned int totalLength = m->data[1] | m->data[2] << 8;
+      unsigned int totalPackets = m->data[3];
+      int transferPgn = m->data[5] | m->data[6] << 8 | m->data[7] << 16;
+
+      // Only follow transfers we can decode
+      baton->j1939Sessions.erase(sessionKey);
+      if (baton->activeDefinitions.count(transferPgn) == 0 ||
+          totalLength > J1939_TP_MAX_LENGTH || totalPackets != (totalLength + 6) / 7) {
+        return signals;
+      }
+
+      j1939Session& session = baton->j1939Sessions[sessionKey];
+      session.pgn = transferPgn;
+      session.totalLength = totalLength;
+      session.totalPackets = totalPackets;
+      session.nextPacket = 1;
+      session.lastTimestamp = m->timestamp;
+      session.data.assign(totalPackets * 7, 0xFF);
+
+    } else if (control == J1939_TP_CM_CTS) {
+
+      // The receiver sends CTS, so the transfer is keyed the other way around
+      auto it = baton->j1939Sessions.find(destinationAddress << 8 | sourceAddress);
+      if (it != baton->j1939Sessions.end() && m->data[2] != 0) {
+        it->second.nextPacket = m->data[2];
+        it->second.lastTimestamp = m->timestamp;
+      }
+
+    } else if (control == J1939_TP_CM_ABORT) {
+      baton->j1939Sessions.erase(sessionKey);
+      baton->j1939Sessions.erase(destinationAddress << 8 | sourceAddress);
+    }
+
+    return signals;
+  }
+
+  if (pgn == J1939_PGN_TP_DT) {
+    auto it = baton->j1939Sessions.find(sessionKey);
+    if (it == baton->j1939Sessions.end() || m->length < 1) {
+      return signals;
+    }
+    j1939Session& session = it->second;
+
+    // Drop transfers that stall or skip a packet
+    unsigned int packet = m->data[0];
+    if (m->timestamp - session.lastTimestamp > J1939_TP_TIMEOUT || packet != session.nextPacket ||
+        packet > session.totalPackets) {
+      baton->j1939Sessions.erase(it);
+      return signals;
+    }
+
+    for (unsigned int i = 1; i < m->length; i++) {
+      session.data[(packet - 1) * 7 + i - 1] = m->data[i];
+    }
+    session.nextPacket++;
+    session.lastTimestamp = m->timestamp;
+
+    if (packet == session.totalPackets) {
+      signals = J1939Parse(baton->activeDefinitions, session.pgn, sourceAddress, &session.data[0], session.totalLength);
+      baton->j1939Sessions.erase(it);
+    }
+    return signals;
+  }
+
+  return J1939Parse(baton->activeDefinitions, pgn, sourceAddress, m->data, m->length);
+}
+
+// Queues a write's outcome for its callback, if it has one
+void CompleteWrite(writeCompletion* completion, int status, unsigned long timestamp) {
+  if (completion == NULL) {
+    return;
+  }
+  completion->status = status;
+  completion->timestamp = timestamp;
+
+  uv_mutex_lock(&writeCompletions.lock);
+  writeCompletions.completions.push(completion);
+  uv_mutex_unlock(&writeCompletions.lock);
+
+  uv_async_send(&writeCompletions.async);
+}
+
+// Adds a frame for a signal, replacing (and completing as superseded) one still pending for it
+void ScheduleFrame(transmitScheduler* scheduler, canMessage* m, int signal, int priority) {
+  uv_mutex_lock(&scheduler->lock);
+
+  auto previous = scheduler->pendingBySignal.find(signal);
+  if (previous != scheduler->pendingBySignal.end()) {
+    auto frame = scheduler->pending.find(previous->second);
+    CompleteWrite(frame->second.message->completion, WRITE_SUPERSEDED, 0);
+    delete frame->second.message;
+    scheduler->pending.erase(frame);
+  }
+
+  transmitKey key(priority, m->id, scheduler->sequence++);
+  pendingFrame frame;
+  frame.message = m;
+  frame.signal = signal;
+  scheduler->pending[key] = frame;
+  scheduler->pendingBySignal[signal] = key;
+
+  if (scheduler->pending.size() > 80) {
+      printf("WARNING: There are %lu unsent messages\n", scheduler->pending.size());
+  }
+
+  uv_mutex_unlock(&scheduler->lock);
+
+  // Let others know there is something to send
+  uv_cond_signal(&scheduler->notEmpty);
+}
+
+// Waits for a frame and returns the most urgent one
+canMessage* NextFrame(transmitScheduler* scheduler) {
+  uv_mutex_lock(&scheduler->lock);
+
+  while (scheduler->pending.empty()) {
+    uv_cond_wait(&scheduler->notEmpty, &scheduler->lock);
+  }
+
+  auto frame = scheduler->pending.begin();
+  canMessage* m = frame->second.message;
+  scheduler->pendingBySignal.erase(frame->second.signal);
+  scheduler->pending.erase(frame);
+
+  uv_mutex_unlock(&scheduler->lock);
+  return m;
+}
+
+/*
+  Runs the callbacks of finished writes with (error, timestamp).
+  Must run in the V8 thread.
+*/
+void ExecuteWriteCallbacks(uv_async_t* handle, int status /*UNUSED*/) {
+
+    HandleScope scope;
+
+    uv_mutex_lock(&writeCompletions.lock);
+
+    while (!writeCompletions.completions.empty()) {
+
+        writeCompletion* c = writeCompletions.completions.front();
+        writeCompletions.completions.pop();
+
+        uv_mutex_unlock(&writeCompletions.lock);
+
+        Local<Value> error = Local<Value>::New(Null());
+        if (c->status == WRITE_SUPERSEDED) {
+            error = Exception::Error(String::New("Superseded by a later write"));
+        } else if (c->status == WRITE_UNKNOWN_SIGNAL) {
+            error = Exception::Error(String::New("Unknown signal"));
+        } else if (c->status != canOK) {
+            char text[64];
+            canGetErrorText((canStatus) c->status, text, sizeof(text));
+            error = Exception::Error(String::New(text));
+        }
+
+        const unsigned argc = 2;
+        Local<Value> argv[argc] = {
+            error,
+            Local<Value>::New(Number::New(c->timestamp))
+        };
+        TryCatch tryCatch;
+        c->callback->Call(Context::GetCurrent()->Global(), argc, argv);
+        if (tryCatch.HasCaught()) {
+            node::FatalException(tryCatch);
+        }
+
+        c->callback.Dispose();
+        delete c;
+
+        uv_mutex_lock(&writeCompletions.lock);
+    }
+
+    uv_mutex_unlock(&writeCompletions.lock);
+}
+
+// Copies a frame into the raw frame tap and wakes up JavaScript
+void RawTapWrite(rawFrameTap* tap, int channel, bool isTx, const canMessage* m) {
+  uv_mutex_lock(&tap->lock);
+
+  uint32_t cursor;
+  memcpy(&cursor, tap->memory, 4);
+
+  char* record = tap->memory + RAW_TAP_HEADER_SIZE + (cursor & (RAW_TAP_FRAMES - 1)) * RAW_TAP_RECORD_SIZE;
+  uint32_t id = m->id;
+  uint32_t timestamp = m->timestamp;
+  uint32_t flags = m->flags;
+  memcpy(record, &id, 4);
+  memcpy(record + 4, &timestamp, 4);
+  memcpy(record + 8, &flags, 4);
+  record[12] = m->length;
+  record[13] = channel | (isTx ? RAW_TAP_TX : 0);
+  memcpy(record + 16, m->data, min(m->length, 8u));
+
+  // Publish the record only once it is complete
+  __atomic_store_n((uint32_t*) tap->memory, cursor + 1, __ATOMIC_RELEASE);
+
+  for (auto it = tap->asyncs.begin(); it != tap->asyncs.end(); ++it) {
+    uv_async_send(*it);
+  }
+  uv_mutex_unlock(&tap->lock);
+}
+
+/*
+  Lets JavaScript know there are new frames in the raw frame tap.
+  Must run in the V8 thread.
+*/
+void ExecuteRawTapCallback(uv_async_t* handle, int status /*UNUSED*/) {
+
+    HandleScope scope;
+
+    rawTapCallbackBaton* baton = (rawTapCallbackBaton*) handle->data;
+
+    TryCatch tryCatch;
+    baton->callback->Call(baton->context, 0, NULL);
+    if (tryCatch.HasCaught()) {
+        node::FatalException(tryCatch);
+    }
+}
+
+// The raw frame tap's memory lives as long as the process, even once it's closed
+void RawTapFree(char* data, void* hint) { }
+
+// Returns the idTiming of a frame's id, adding it if there's room, or NULL
+idTiming* AnalyzerSlot(busAnalyzer* a, long id, bool isExtended) {
+  unsigned short* slot;
+  if (!isExtended) {
+    slot = &a->stdSlots[id & (ANALYZER_STD_IDS - 1)];
+  } else {
+    size_t bucket = ((unsigned long) id * 2654435761UL) & (ANALYZER_EXT_BUCKETS - 1);
+    while (a->extSlots[bucket] != 0 && a->extIds[bucket] != id) {
+      bucket = (bucket + 1) & (ANALYZER_EXT_BUCKETS - 1);
+    }
+    slot = &a->extSlots[bucket];
+    a->extIds[bucket] = id;
+  }
+
+  if (*slot == 0) {
+    if (a->timings.size() >= ANALYZER_MAX_IDS) {
+      return NULL;
+    }
+    idTiming t;
+    memset(&t, 0, sizeof(t));
+    t.id = id;
+    t.isExtended = isExtended;
+    a->timings.push_back(t);
+    *slot = a->timings.size();
+  }
+  return &a->timings[*slot - 1];
+}
+
+busAnalyzer* CreateAnalyzer() {
+  busAnalyzer* a = new busAnalyzer;
+  a->stdSlots.assign(ANALYZER_STD_IDS, 0);
+  a->extSlots.assign(ANALYZER_EXT_BUCKETS, 0);
+  a->extIds.assign(ANALYZER_EXT_BUCKETS, 0);
+  a->timings.reserve(ANALYZER_MAX_IDS);
+  a->started = false;
+  return a;
+}
+
+// Passes what a busAnalyzer measured since start on to JavaScript and starts over at now
+void AnalyzerSnapshot(busAnalyzer* a, int bus, int baudRate, unsigned long now) {
+  busSnapshot* snapshot = new busSnapshot;
+  double seconds = max(now - a->start, 1UL) / 1000.0;
+  snapshot->bus = bus;
+  snapshot->start = a->start;
+  snapshot->end = now;
+  snapshot->frames = a->frames;
+  snapshot->errorFrames = a->errorFrames;
+  snapshot->untracked = a->untracked;
+  snapshot->load = a->bits / (baudRate * seconds);
+
+  for (auto t = a->timings.begin(); t != a->timings.end(); ++t) {
+    idStats stats;
+    stats.id = t->id;
+    stats.isExtended = t->isExtended;
+    stats.count = t->count;
+    stats.rate = t->count / seconds;
+    stats.minPeriod = t->periods > 0 ? t->minPeriod : 0;
+    stats.maxPeriod = t->maxPeriod;
+    stats.meanPeriod = t->periods > 0 ? t->sumPeriods / t->periods : 0;
+    stats.jitter = t->periods > 0 ?
+      sqrt(max(t->sumSquaredPeriods / t->periods - stats.meanPeriod * stats.meanPeriod, 0.0)) : 0;
+    stats.missing = t->missing;
+    stats.stalled = t->expectedPeriod > 0 && now > t->last &&
+      now - t->last > ANALYZER_STALL_FACTOR * t->expectedPeriod;
+    stats.lastSeen = t->last;
+    snapshot->ids.push_back(stats);
+
+    t->count = 0;
+    t->periods = 0;
+    t->minPeriod = 0;
+    t->maxPeriod = 0;
+    t->sumPeriods = 0;
+    t->sumSquaredPeriods = 0;
+    t->missing = 0;
+  }
+
+  a->start = now;
+  a->frames = 0;
+  a->errorFrames = 0;
+  a->untracked = 0;
+  a->bits = 0;
+
+  uv_mutex_lock(&busSnapshots.lock);
+  busSnapshots.snapshots.push(snapshot);
+  uv_mutex_unlock(&busSnapshots.lock);
+  uv_async_send(&busSnapshots.async);
+}
+
+// Takes a snapshot if an interval has passed by now
+void AnalyzerTick(busAnalyzer* a, int bus, int baudRate, unsigned long now) {
+  if (!a->started) {
+    a->started = true;
+    a->start = now;
+    a->frames = 0;
+    a->errorFrames = 0;
+    a->untracked = 0;
+    a->bits = 0;
+  } else if (now >= a->start && now - a->start >= analyzerInterval.load()) {
+    AnalyzerSnapshot(a, bus, baudRate, now);
+  }
+}
+
+// Adds a frame to the bus load and its id's timing
+void AnalyzeFrame(busAnalyzer* a, const canMessage* m) {
+  a->frames++;
+  if (m->flags & canMSG_ERROR_FRAME) {
+    a->errorFrames++;
+    return;
+  }
+
+  bool isExtended = (m->flags & canMSG_EXT) != 0;
+  int dataBits = (m->flags & canMSG_RTR) ? 0 : 8 * min(m->length, 8U);
+  a->bits += (isExtended ? EXT_FRAME_OVERHEAD_BITS : STD_FRAME_OVERHEAD_BITS) + dataBits;
+
+  idTiming* t = AnalyzerSlot(a, m->id, isExtended);
+  if (t == NULL) {
+    a->untracked++;
+    return;
+  }
+
+  t->count++;
+  if (t->seen) {
+    double period = m->timestamp - t->last;
+    if (t->periods == 0 || period < t->minPeriod) {
+      t->minPeriod = period;
+    }
+    t->maxPeriod = max(t->maxPeriod, period);
+    t->periods++;
+    t->sumPeriods += period;
+    t->sumSquaredPeriods += period * period;
+
+    // Late frames count as missing ones and don't move the expected period, unless they
+    // keep coming
+    if (t->expectedPeriod > 0 && period > ANALYZER_LATE_FACTOR * t->expectedPeriod &&
+        ++t->latePeriods < ANALYZER_LATE_RESET) {
+      t->missing += (unsigned long) (period / t->expectedPeriod + 0.5) - 1;
+    } else {
+      t->expectedPeriod = t->expectedPeriod == 0 || t->latePeriods > 0 ?
+        period : t->expectedPeriod + (period - t->expectedPeriod) / 8;
+      t->latePeriods = 0;
+    }
+  }
+  t->seen = true;
+  t->last = m->timestamp;
+}
+
+// Appends the low bits of value to w
+void WriteBits(bitWriter& w, uint64_t value, int bits) {
+  while (bits > 0) {
+    if (w.free == 0) {
+      w.bytes.push_back(0);
+      w.free = 8;
+    }
+    int n = min(bits, w.free);
+    unsigned char part = (value >> (bits - n)) & ((1 << n) - 1);
+    w.bytes[w.bytes.size() - 1] |= part << (w.free - n);
+    w.free -= n;
+    bits -= n;
+  }
+}
+
+// Reads bits into value, returns false past the end
+bool ReadBits(bitReader& r, int bits, uint64_t& value) {
+  if (r.bit + bits > r.length * 8) {
+    return false;
+  }
+  value = 0;
+  while (bits > 0) {
+    int available = 8 - r.bit % 8;
+    int n = min(bits, available);
+    value = (value << n) | ((r.data[r.bit / 8] >> (available - n)) & ((1 << n) - 1));
+    r.bit += n;
+    bits -= n;
+  }
+  return true;
+}
+
+// Appends an unsigned little endian integer of bytes bytes
+void AppendLittleEndian(string& s, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    s.push_back((char) (value >> (8 * i)));
+  }
+}
+
+uint64_t ReadLittleEndian(const unsigned char* data, int bytes) {
+  uint64_t value = 0;
+  for (int i = bytes - 1; i >= 0; i--) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+
+// Milliseconds since the epoch
+long long WallTime() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (long long) now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+// Sets offset to what turns a channel's driver timestamps into ms since the epoch
+bool DriverTimeOffset(int channel, int flags, long long& offset) {
+  canHandle handle = canOpenChannel(channel, flags);
+  if (handle < 0) {
+    return false;
+  }
+  unsigned long now;
+  canReadTimer(handle, &now);
+  offset = WallTime() - (long long) now;
+  canClose(handle);
+  return true;
+}
+
+// Encodes a timestamp as the change in its delta: 0 in one bit, small changes in a few
+void EncodeTimestamp(chunkEncoder* e, unsigned long timestamp) {
+  long long delta = (long long) timestamp - (long long) e->lastTimestamp;
+  long long dod = delta - e->lastDelta;
+  if (dod == 0) {
+    WriteBits(e->times, 0, 1);
+  } else if (dod >= -63 && dod <= 64) {
+    WriteBits(e->times, 2, 2);
+    WriteBits(e->times, dod + 63, 7);
+  } else if (dod >= -255 && dod <= 256) {
+    WriteBits(e->times, 6, 3);
+    WriteBits(e->times, dod + 255, 9);
+  } else if (dod >= -2047 && dod <= 2048) {
+    WriteBits(e->times, 14, 4);
+    WriteBits(e->times, dod + 2047, 12);
+  } else {
+    WriteBits(e->times, 15, 4);
+    WriteBits(e->times, (uint64_t) dod, 64);
+  }
+  e->lastTimestamp = timestamp;
+  e->lastDelta = delta;
+}
+
+/*
+  Encodes a value as its XOR with the last one: an unchanged value in one bit, otherwise
+  the bits that changed, reusing the last leading and trailing zero counts if they fit.
+*/
+void EncodeValue(chunkEncoder* e, double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint64_t x = bits ^ e->lastValue;
+  e->lastValue = bits;
+
+  if (x == 0) {
+    WriteBits(e->values, 0, 1);
+    return;
+  }
+
+  int leading = min(__builtin_clzll(x), 31);
+  int trailing = __builtin_ctzll(x);
+  if (e->lastLeading != -1 && leading >= e->lastLeading && trailing >= e->lastTrailing) {
+    WriteBits(e->values, 2, 2);
+    WriteBits(e->values, x >> e->lastTrailing, 64 - e->lastLeading - e->lastTrailing);
+  } else {
+    int meaningful = 64 - leading - trailing;
+    WriteBits(e->values, 3, 2);
+    WriteBits(e->values, leading, 5);
+    WriteBits(e->values, meaningful - 1, 6);
+    WriteBits(e->values, x >> trailing, meaningful);
+    e->lastLeading = leading;
+    e->lastTrailing = trailing;
+  }
+}
+
+// Closes an encoder's chunk into the logger's pending records, waking the writer thread
+// once there's enough for a write
+void FinishChunk(signalLogger* l, chunkEncoder* e) {
+  string& s = l->pending;
+  s.push_back(LOG_RECORD_CHUNK);
+  s.push_back(0);
+  AppendLittleEndian(s, e->signal, 2);
+  AppendLittleEndian(s, (uint16_t) e->sourceAddress, 2);
+  AppendLittleEndian(s, 0, 2);
+  AppendLittleEndian(s, e->count, 4);
+  AppendLittleEndian(s, e->firstTime, 8);
+  AppendLittleEndian(s, e->times.bytes.size(), 4);
+  AppendLittleEndian(s, e->values.bytes.size(), 4);
+  s.append(e->times.bytes);
+  s.append(e->values.bytes);
+
+  e->count = 0;
+  e->times.bytes.clear();
+  e->times.free = 0;
+  e->values.bytes.clear();
+  e->values.free = 0;
+
+  if (s.size() >= LOG_WRITE_SIZE) {
+    uv_cond_signal(&logNotEmpty);
+  }
+}
+
+// Adds a sample to its signal's chunk. Called with logLock held
+void LogSample(signalLogger* l, int bus, const canSignal* s) {
+  chunkEncoder*& e = l->encoders[s->id << 9 | (s->sourceAddress + 1)];
+  if (e == NULL) {
+    e = new chunkEncoder;
+    e->signal = s->id;
+    e->sourceAddress = s->sourceAddress;
+    e->count = 0;
+    e->times.free = 0;
+    e->values.free = 0;
+  }
+
+  if (e->count == 0) {
+    e->opened = time(NULL);
+    e->firstTime = l->timeOffset[bus] + (long long) s->timestamp;
+    e->lastTimestamp = s->timestamp;
+    e->lastDelta = 0;
+    memcpy(&e->lastValue, &s->value, sizeof(e->lastValue));
+    e->lastLeading = -1;
+    WriteBits(e->values, e->lastValue, 64);
+  } else {
+    EncodeTimestamp(e, s->timestamp);
+    EncodeValue(e, s->value);
+  }
+
+  if (++e->count >= LOG_CHUNK_SAMPLES) {
+    FinishChunk(l, e);
+  }
+}
+
+// Logs the signals of a message that are being logged
+void LogSignals(canProcessReadBaton* baton, const vector<canSignal*>& signals) {
+  uv_mutex_lock(&logLock);
+  if (logger != NULL) {
+    for (auto it = signals.begin(); it != signals.end(); ++it) {
+      if (baton->loggedSignals[(*it)->id]) {
+        LogSample(logger, baton->bus, *it);
+      }
+    }
+  }
+  uv_mutex_unlock(&logLock);
+}
+
+/*
+  Writes a signal logger's records out until it stops, at least every LOG_FLUSH_INTERVAL
+  and otherwise in writes of about LOG_WRITE_SIZE. Chunks open longer than LOG_CHUNK_AGE
+  are closed, so a crash loses little.
+  Does not need to run in the V8 thread.
+*/
+void WriteLog(void* arg) {
+
+    signalLogger* l = (signalLogger*) arg;
+    string buffer;
+
+    uv_mutex_lock(&logLock);
+
+    while (1) {
+        if (!l->stopping && l->pending.size() < LOG_WRITE_SIZE) {
+            uv_cond_timedwait(&logNotEmpty, &logLock, LOG_FLUSH_INTERVAL * 1000000000ULL);
+        }
+
+        time_t now = time(NULL);
+        for (auto it = l->encoders.begin(); it != l->encoders.end(); ++it) {
+            if (it->second->count > 0 && (l->stopping || now - it->second->opened >= LOG_CHUNK_AGE)) {
+                FinishChunk(l, it->second);
+            }
+        }
+
+        buffer.swap(l->pending);
+        bool stopping = l->stopping;
+
+        // Write without holding up the processing threads
+        uv_mutex_unlock(&logLock);
+
+        size_t written = 0;
+        while (written < buffer.size()) {
+            ssize_t n = write(l->fd, buffer.data() + written, buffer.size() - written);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                printf("ERROR: Writing the signal log failed: %s\n", strerror(errno));
+                break;
+            }
+            written += n;
+        }
+        buffer.clear();
+
+        if (stopping) {
+            return;
+        }
+
+        uv_mutex_lock(&logLock);
+    }
+}
+
+// A signal and source address read back from a signal log
+struct logSeries {
+    int signal;
+    int sourceAddress;
+    vector<double> timestamps;
+    vector<double> values;
+};
+
+// Data to pass to the work of stopLog and readLog, done off the V8 thread
+struct logWorkBaton {
+    uv_work_t request;
+    Persistent<Function> callback;
+
+    // stopLog
+    signalLogger* logger;
+
+    // readLog
+    string path;
+    string error;
+    unordered_map<int, string> signalNames;
+    vector<logSeries> series;
+};
+
+// Decodes a chunk record's samples into series. Returns false if it's corrupt
+bool DecodeChunk(const unsigned char* record, logSeries& series) {
+  unsigned long count = ReadLittleEndian(record + 8, 4);
+  long long time = (long long) ReadLittleEndian(record + 12, 8);
+  bitReader times = { record + LOG_CHUNK_HEADER_SIZE, (size_t) ReadLittleEndian(record + 20, 4), 0 };
+  bitReader values = { times.data + times.length, (size_t) ReadLittleEndian(record + 24, 4), 0 };
+
+  long long delta = 0;
+  uint64_t value = 0;
+  int leading = 0, trailing = 0;
+  for (unsigned long i = 0; i < count; i++) {
+    uint64_t bits;
+    if (i == 0) {
+      if (!ReadBits(values, 64, value)) {
+        return false;
+      }
+    } else {
+      // Timestamp, see EncodeTimestamp
+      int prefix = 0;
+      while (prefix < 4 && ReadBits(times, 1, bits) && bits == 1) {
+        prefix++;
+      }
+      static const int widths[] = { 0, 7, 9, 12, 64 };
+      static const long long biases[] = { 0, 63, 255, 2047, 0 };
+      if (!ReadBits(times, widths[prefix], bits)) {
+        return false;
+      }
+      delta += (long long) bits - biases[prefix];
+      time += delta;
+
+      // Value, see EncodeValue
+      if (!ReadBits(values, 1, bits)) {
+        return false;
+      }
+      if (bits == 1) {
+        uint64_t control, meaningful, x;
+        if (!ReadBits(values, 1, control)) {
+          return false;
+        }
+        if (control == 1) {
+          if (!ReadBits(values, 5, bits) || !ReadBits(values, 6, meaningful)) {
+            return false;
+          }
+          leading = bits;
+          trailing = 64 - leading - (meaningful + 1);
+        }
+        if (!ReadBits(values, 64 - leading - trailing, x)) {
+          return false;
+        }
+        value ^= x << trailing;
+      }
+    }
+
+    double decoded;
+    memcpy(&decoded, &value, sizeof(decoded));
+    series.timestamps.push_back(time);
+    series.values.push_back(decoded);
+  }
+  return true;
+}
+
+/*
+  Fires the analyzer callback for each snapshot the bus threads took.
+  This function must run in the V8 thread
+*/
+void ExecuteAnalyzerCallbacks(uv_async_t* handle, int status /*UNUSED*/) {
+
+    HandleScope scope;
+
+    uv_mutex_lock(&busSnapshots.lock);
+
+    while (!busSnapshots.snapshots.empty()) {
+
+        busSnapshot* snapshot = busSnapshots.snapshots.front();
+        busSnapshots.snapshots.pop();
+
+        uv_mutex_unlock(&busSnapshots.lock);
+
+        // Snapshots taken just before stopAnalyzer are dropped
+        if (!busSnapshots.callback.IsEmpty()) {
+            Local<Array> ids = Array::New(snapshot->ids.size());
+            for (size_t i = 0; i < snapshot->ids.size(); i++) {
+                const idStats& stats = snapshot->ids[i];
+                Local<Object> id = Object::New();
+                id->Set(String::NewSymbol("id"), Number::New(stats.id));
+                id->Set(String::NewSymbol("extended"), Boolean::New(stats.isExtended));
+                id->Set(String::NewSymbol("count"), Number::New(stats.count));
+                id->Set(String::NewSymbol("rate"), Number::New(stats.rate));
+                id->Set(String::NewSymbol("minPeriod"), Number::New(stats.minPeriod));
+                id->Set(String::NewSymbol("maxPeriod"), Number::New(stats.maxPeriod));
+                id->Set(String::NewSymbol("meanPeriod"), Number::New(stats.meanPeriod));
+                id->Set(String::NewSymbol("jitter"), Number::New(stats.jitter));
+                id->Set(String::NewSymbol("missing"), Number::New(stats.missing));
+                id->Set(String::NewSymbol("stalled"), Boolean::New(stats.stalled));
+                id->Set(String::NewSymbol("lastSeen"), Number::New(stats.lastSeen));
+                ids->Set(i, id);
+            }
+
+            Local<Object> result = Object::New();
+            result->Set(String::NewSymbol("bus"), String::NewSymbol(snapshot->bus == BUS_HS ? "hs" : "ls"));
+            result->Set(String::NewSymbol("start"), Number::New(snapshot->start));
+            result->Set(String::NewSymbol("end"), Number::New(snapshot->end));
+            result->Set(String::NewSymbol("frames"), Number::New(snapshot->frames));
+            result->Set(String::NewSymbol("errorFrames"), Number::New(snapshot->errorFrames));
+            result->Set(String::NewSymbol("untracked"), Number::New(snapshot->untracked));
+            result->Set(String::NewSymbol("load"), Number::New(snapshot->load));
+            result->Set(String::NewSymbol("ids"), ids);
+
+            const unsigned argc = 1;
+            Local<Value> argv[argc] = { result };
+            TryCatch tryCatch;
+            busSnapshots.callback->Call(Context::GetCurrent()->Global(), argc, argv);
+            if (tryCatch.HasCaught()) {
+                node::FatalException(tryCatch);
+            }
+        }
+
+        delete snapshot;
+
+        uv_mutex_lock(&busSnapshots.lock);
+    }
+
+    uv_mutex_unlock(&busSnapshots.lock);
+}
+
+/*
+  Fires the callback function for each signal in the processedQueue.
+  This function should be signaled via the async when a signal is added to the processedQueue.
+  This function must run in the V8 thread
+*/
+void ExecuteCallbacks(uv_async_t* handle, int status /*UNUSED*/) {
+
+    HandleScope scope;
+
+    // Retrieve baton
+    canReadCallbackBaton* baton = (canReadCallbackBaton*) handle->data;
+
+    // Lock the processedQueue
+    uv_mutex_lock(baton->processedReadQueueLock);
+
+    // Run until it is empty
+    while (!baton->processedReadQueue->empty()) {
+
+        // Dequeue a signal
+        canSignal* s = baton->processedReadQueue->front();
+        baton->processedReadQueue->pop();
+
+        // Let others access the queue while we callback
+        uv_mutex_unlock(baton->processedReadQueueLock);
+
+        // Callback to the JS
+        const unsigned argc = 3;
+        Local<Value> argv[argc] = {
+            Local<Value>::New(registry.v8Names[s->id]),
+            Local<Value>::New(Number::New(s->value)),
+            s->sourceAddress < 0 ? Local<Value>::New(Undefined()) : Local<Value>::New(Integer::New(s->sourceAddress))
+        };
+        TryCatch tryCatch;
+        baton->callback->Call(baton->context, argc, argv);
+        if (tryCatch.HasCaught()) {
+            node::FatalException(tryCatch);
+        }
+
+        // Clean up
+        delete s;
+
+        // Regain the lock before looping again
+        uv_mutex_lock(baton->processedReadQueueLock);
+    }
+
+    // Then the finished windows
+    while (!baton->processedAggregateQueue->empty()) {
+
+        signalAggregate* a = baton->processedAggregateQueue->front();
+        baton->processedAggregateQueue->pop();
+
+        uv_mutex_unlock(baton->processedReadQueueLock);
+
+        if (!baton->aggregateCallback.IsEmpty()) {
+            Local<Object> result = Object::New();
+            result->Set(String::NewSymbol("start"), Number::New(a->start));
+            result->Set(String::NewSymbol("end"), Number::New(a->end));
+            result->Set(String::NewSymbol("count"), Number::New(a->count));
+            result->Set(String::NewSymbol("min"), Number::New(a->min));
+            result->Set(String::NewSymbol("max"), Number::New(a->max));
+            result->Set(String::NewSymbol("mean"), Number::New(a->mean));
+            result->Set(String::NewSymbol("last"), Number::New(a->last));
+            result->Set(String::NewSymbol("integral"), Number::New(a->integral));
+            result->Set(String::NewSymbol("rate"), Number::New(a->rate));
+
+            const unsigned argc = 3;
+            Local<Value> argv[argc] = {
+                Local<Value>::New(registry.v8Names[a->id]),
+                result,
+                a->sourceAddress < 0 ? Local<Value>::New(Undefined()) : Local<Value>::New(Integer::New(a->sourceAddress))
+            };
+            TryCatch tryCatch;
+            baton->aggregateCallback->Call(baton->context, argc, argv);
+            if (tryCatch.HasCaught()) {
+                node::FatalException(tryCatch);
+            }
+        }
+
+        delete a;
+
+        uv_mutex_lock(baton->processedReadQueueLock);
+    }
+
+    // We are all finished with the queue, so let others fill it up
+    uv_mutex_unlock(baton->processedReadQueueLock);
+}
+
+// Adds a message to the baton's readQueue and lets the processing thread know
+void QueueRead(canReadBaton* baton, canMessage* m) {
+    uv_mutex_lock(baton->readQueueLock);
+    baton->readQueue->push(m);
+
+    if (baton->readQueue->size() >= 10) {
+        printf("WARNING: There are %lu unprocessed messages\n", baton->readQueue->size());
+    }
+    uv_mutex_unlock(baton->readQueueLock);
+
+    // Let others know there is something to process
+    uv_cond_signal(baton->readQueueNotEmpty);
+}
+
+/*
+  Constantly reads messages from a CAN bus using the baton's params (never exiting).
+  Pushes messages onto the baton's readQueue.
+  req->data should be a canReadBaton.
+  Does not need to run in the V8 thread.
+*/
+void ReadMessages(void* arg) {
+
+    // Retrieve baton
+    canReadBaton* baton = (canReadBaton*) arg;
+
+    canHandle handle = canOpenChannel(baton->channel, baton->canFlags);
     if (handle < 0) {
       printf("ERROR: canOpenChannel %d failed: %d\n", baton->channel, handle);
       return;
@@ -395,34 +2201,79 @@ void ReadMessages(void* arg) {
     canSetBusParams(handle, baton->baudRate, baton->tseg1, baton->tseg2, baton->sjw, baton->samplePoints, baton->syncMode);
     canBusOn(handle);
 
+    busAnalyzer* analyzer = NULL;
+    unsigned long lastTick = 0;
+
     while (1) {
 
+        // Only read the ids someone is subscribed to
+        if (RefreshActiveDefinitions(baton->bus, baton->definitionsReader, baton->definitionsEpoch,
+                                     baton->activeDefinitions, baton->subscriptionVersion)) {
+            UpdateAcceptanceFilter(handle, baton);
+        }
+
+        bool analyzing = analyzerInterval.load() != 0;
+        if (analyzing && analyzer == NULL) {
+            analyzer = CreateAnalyzer();
+        } else if (!analyzing && analyzer != NULL) {
+            delete analyzer;
+            analyzer = NULL;
+        }
+
         // Create message
-        unsigned int flags;
-        unsigned long timestamp;
         canMessage* m = new canMessage;
-        canReadWait(handle, &m->id, m->data, &m->length, &flags, &timestamp, 0xFFFFFFFF);
+        canStatus status = canReadWait(handle, &m->id, m->data, &m->length, &m->flags, &m->timestamp, READ_TIMEOUT);
+        unsigned long now = m->timestamp;
+        if (status != canOK) {
+            canReadTimer(handle, &now);
+        }
 
-        if (flags & canMSG_EXT) {
-            long mask = ((1 << 16) - 1) << 13;
-            m->id = m->id & mask;
+        // Let the processing thread close aggregation windows, however quiet the bus is
+        if (now - lastTick >= READ_TIMEOUT) {
+            canMessage* tick = new canMessage;
+            tick->id = READ_TICK_ID;
+            tick->length = 0;
+            tick->flags = 0;
+            tick->timestamp = now;
+            QueueRead(baton, tick);
+            lastTick = now;
         }
 
-        if (baton->signalDefinitions.count(m->id) == 0) {
+        if (status != canOK) {
+            if (analyzer != NULL) {
+                AnalyzerTick(analyzer, baton->bus, baton->baudRate, now);
+            }
+            delete m;
             continue;
         }
 
-        // Add message to readQueue
-        uv_mutex_lock(baton->readQueueLock);
-        baton->readQueue->push(m);
+        // Every frame counts towards the bus load, subscribed or not
+        if (analyzer != NULL) {
+            AnalyzerTick(analyzer, baton->bus, baton->baudRate, m->timestamp);
+            AnalyzeFrame(analyzer, m);
+        }
 
-        if (baton->readQueue->size() >= 10) {
-            printf("WARNING: There are %lu unprocessed messages\n", baton->readQueue->size());
+        rawFrameTap* tap = rawTap.load();
+        if (tap != NULL) {
+            RawTapWrite(tap, baton->channel, false, m);
+        }
+
+        long key = ReadSignalKey(baton->idFormat, m->id, m->flags);
+
+        // J1939 ids keep their source address, so the processing side can reassemble
+        // transfers and tell nodes apart
+        if (baton->idFormat != ID_FORMAT_J1939 || !(m->flags & canMSG_EXT)) {
+            m->id = key;
+        } else if (key == J1939_PGN_TP_CM || key == J1939_PGN_TP_DT) {
+            key = -1;
+        }
+
+        if (key != -1 && baton->activeDefinitions.count(key) == 0) {
+            delete m;
+            continue;
         }
-        uv_mutex_unlock(baton->readQueueLock);
 
-        // Let others know there is something to process
-        uv_cond_signal(baton->readQueueNotEmpty);
+        QueueRead(baton, m);
     }
 }
 
@@ -453,183 +2304,855 @@ void ProcessReadMessages(void* arg) {
         // Unlock hsReadQueue while we process the message
         uv_mutex_unlock(baton->readQueueLock);
 
-        vector<canSignal*> signals = ReadParse(baton->signalDefinitions, m->id, m->data, m->length);
+        // Only decode the signals someone is subscribed to
+        RefreshProcessing(baton);
+
+        vector<canSignal*> signals;
+        bool tick = m->id == READ_TICK_ID;
+        if (tick) {
+            // Ticks only carry the driver time
+        } else if (baton->idFormat == ID_FORMAT_J1939 && (m->flags & canMSG_EXT)) {
+            signals = J1939Process(baton, m);
+        } else {
+            signals = ReadParse(baton->activeDefinitions, m->id, m->data, m->length);
+        }
 
-        // Lock processedQueue
-        uv_mutex_lock(baton->processedReadQueueLock);
+        for (auto it = signals.begin(); it != signals.end(); ++it) {
+            (*it)->timestamp = m->timestamp;
+        }
+
+        if (baton->logging && !signals.empty()) {
+            LogSignals(baton, signals);
+        }
 
+        // Aggregate signals, and only pass on the ones with listeners
+        vector<canSignal*> delivered;
+        vector<signalAggregate*> aggregates;
+        if (tick) {
+            for (auto a = baton->aggregators.begin(); a != baton->aggregators.end(); ++a) {
+                CloseWindows(a->second, a->first >> 9, m->timestamp, aggregates);
+            }
+        }
         for (auto it = signals.begin(); it != signals.end(); ++it) {
-            baton->processedReadQueue->push(*it);        }
-        if (baton->processedReadQueue->size() >= 80) {
-            printf("WARNING: There are %lu unfired signals\n", baton->processedReadQueue->size());
+            if (!baton->aggregations.empty()) {
+                auto def = baton->aggregations.find((*it)->id);
+                if (def != baton->aggregations.end()) {
+                    signalAggregator*& a = baton->aggregators[(*it)->id << 9 | ((*it)->sourceAddress + 1)];
+                    if (a == NULL) {
+                        a = new signalAggregator;
+                        a->def = def->second;
+                        a->sourceAddress = (*it)->sourceAddress;
+                        a->panes.resize(def->second.window / def->second.slide);
+                        a->current = 0;
+                        a->started = false;
+                    }
+                    AggregateSample(a, *it, aggregates);
+                }
+            }
+
+            if (baton->callbacks != NULL && baton->deliveredSignals[(*it)->id]) {
+                delivered.push_back(*it);
+            } else {
+                delete *it;
+            }
+        }
+        delete m;
+
+        if (delivered.empty() && aggregates.empty()) {
+            continue;
+        }
+
+        // Nothing to deliver to until start
+        canReadCallbackBaton* callbacks = baton->callbacks;
+        if (callbacks == NULL) {
+            for (auto it = aggregates.begin(); it != aggregates.end(); ++it) {
+                delete *it;
+            }
+            continue;
+        }
+
+        // Lock processedQueue
+        uv_mutex_lock(callbacks->processedReadQueueLock);
+
+        for (auto it = delivered.begin(); it != delivered.end(); ++it) {
+            callbacks->processedReadQueue->push(*it);
+        }
+        for (auto it = aggregates.begin(); it != aggregates.end(); ++it) {
+            callbacks->processedAggregateQueue->push(*it);
+        }
+        if (callbacks->processedReadQueue->size() >= 80) {
+            printf("WARNING: There are %lu unfired signals\n", callbacks->processedReadQueue->size());
         }
 
         // Unlock processedQueue while we go back to waiting for messages
-        uv_mutex_unlock(baton->processedReadQueueLock);
+        uv_mutex_unlock(callbacks->processedReadQueueLock);
 
         // Signal the async that there are signals to fire
-        uv_async_send(baton->processedReadAsync);
+        uv_async_send(callbacks->processedReadAsync);
+    }
+}
+
+/*
+  Constantly processes messages from writeQueue (never exits).
+  req->data should be a canProcessWriteBaton.
+  Does not need to run in the V8 thread.
+*/
+void ProcessWriteMessages(void* arg) {
+
+    // Retrieve baton
+    canProcessWriteBaton* baton = (canProcessWriteBaton*) arg;
+        
+    while (1) {
+        // Lock writeQueue
+        uv_mutex_lock(baton->writeQueueLock);
+
+        // Wait for a message to come in
+        while (baton->writeQueue->empty()) {
+            uv_cond_wait(baton->writeQueueNotEmpty, baton->writeQueueLock);
+        }
+
+        // Pop the message information off the queue
+        canSignal* signal = baton->writeQueue->front();
+	    baton->writeQueue->pop();
+
+        // Unlock queue while we send the message
+        uv_mutex_unlock(baton->writeQueueLock);
+	
+        // The signal may have been dropped by a reload since it was queued
+        definitionTable* table = LoadDefinitions(baton->definitionsReader);
+        if (signal->id >= (int) table->writes.size() || table->writes[signal->id].bus != baton->bus) {
+            DefinitionsOffline(baton->definitionsReader);
+            CompleteWrite(signal->completion, WRITE_UNKNOWN_SIGNAL, 0);
+            delete signal;
+            continue;
+        }
+        const messageDef& definition = table->writes[signal->id].message;
+
+        // Process Message
+        canMessage *m = WriteParse(definition, signal->value);
+        m->completion = signal->completion;
+        int priority = signal->priority >= 0 ? signal->priority : definition.priority;
+
+        DefinitionsOffline(baton->definitionsReader);
+
+        // Hand it to the scheduler
+        ScheduleFrame(baton->scheduler, m, signal->id, priority);
+
+        delete signal;
+    }
+}
+
+/*
+  Waits up to timeout ms for the transmit acknowledgement of the frame we just sent,
+  setting its timestamp to when it went out. Other frames received on the handle are
+  dropped. Returns canOK, or canlib's status if it wasn't acknowledged in time.
+*/
+canStatus WaitForTxAck(canHandle handle, canMessage* m, unsigned long timeout) {
+    unsigned long now, deadline;
+    canReadTimer(handle, &now);
+    deadline = now + timeout;
+
+    while (1) {
+        long id;
+        unsigned char data[8];
+        unsigned int length, flags;
+        unsigned long timestamp;
+        canStatus status = canReadWait(handle, &id, data, &length, &flags, &timestamp, deadline > now ? deadline - now : 0);
+        if (status != canOK) {
+            return status;
+        }
+        if ((flags & canMSG_TXACK) && id == m->id) {
+            m->timestamp = timestamp;
+            return canOK;
+        }
+        canReadTimer(handle, &now);
+    }
+}
+
+/*
+Constantly sends the most urgent message from the scheduler, reporting how it went.
+req->data should be a canReadBaton.
+Does not need to run in the V8 thread.
+*/
+void SendWriteMessages(void* arg) {
+        
+    // Retrieve baton
+    canWriteBaton* baton = (canWriteBaton*) arg;
+    canHandle handle = canOpenChannel(baton->channel, baton->canFlags);
+    if (handle < 0) {
+      printf("ERROR: canOpenChannel %d failed: %d\n", baton->channel, handle);
+      return;
+    }
+    canSetBusParams(handle, baton->baudRate, baton->tseg1, baton->tseg2, baton->sjw, baton->samplePoints, baton->syncMode);
+    canBusOn(handle);
+
+    // Writes are completed from their transmit acknowledgements, which carry the time the
+    // frame went out
+    int txAck = 1;
+    canIoCtl(handle, canIOCTL_SET_TXACK, &txAck, sizeof(txAck));
+
+    while (1) {
+
+        // Wait for the most urgent message
+        canMessage* m = NextFrame(baton->scheduler);
+
+        // Drop what the bus sent this handle while we were idle
+        canIoCtl(handle, canIOCTL_FLUSH_RX_BUFFER, NULL, 0);
+
+        // Send it, one at a time so a more urgent message never waits behind a queue in
+        // the driver
+        canStatus status = canWrite(handle, m->id, m->data, m->length, m->flags);
+        if (status == canOK) {
+            status = WaitForTxAck(handle, m, WRITE_TIMEOUT);
+        }
+        if (status != canOK) {
+            // Don't leave it in the driver, where it would hold up every frame after it. The
+            // flush can't recall a frame the controller is already sending, so give that
+            // one time to be acknowledged before reporting
+            canIoCtl(handle, canIOCTL_FLUSH_TX_BUFFER, NULL, 0);
+            if (WaitForTxAck(handle, m, WRITE_FLUSH_GRACE) != canOK) {
+                status = status == canERR_NOMSG ? canERR_TIMEOUT : status;
+                canReadTimer(handle, &m->timestamp);
+            } else {
+                status = canOK;
+            }
+        }
+        CompleteWrite(m->completion, status, m->timestamp);
+
+        rawFrameTap* tap = rawTap.load();
+        if (status == canOK && tap != NULL && tap->includeTx) {
+            RawTapWrite(tap, baton->channel, true, m);
+        }
+
+        // Clean up
+        delete m;
+    }
+}
+
+/*
+  Queues a write of a signal id on its bus. Args should contain the signal (unused here),
+  a value, and optionally a priority class (anything else throws a RangeError) and a
+  callback for the outcome, which is called with an error right away if id is -1 (an
+  unknown signal).
+*/
+Handle<Value> QueueWrite(const Arguments& args, int id) {
+
+    if (args.Length() < 2) {
+      return ThrowException(Exception::TypeError(String::New("You must pass two arguments")));       
+    }
+
+    // Same priority classes as the write definitions
+    int priority = -1;
+    if (args.Length() > 2 && args[2]->IsNumber()) {
+      double p = args[2]->NumberValue();
+      if (p != floor(p) || p < PRIORITY_HIGH || p > PRIORITY_LOW) {
+        return ThrowException(Exception::RangeError(String::New("The priority must be PRIORITY_HIGH, PRIORITY_NORMAL or PRIORITY_LOW")));
+      }
+      priority = (int) p;
+    }
+
+    canSignal* signal = new canSignal;
+    signal->id = id;
+    signal->value = args[1]->ToInteger()->Value();
+    signal->priority = priority;
+    signal->completion = NULL;
+
+    for (int i = 2; i < args.Length() && i < 4; i++) {
+        if (args[i]->IsFunction()) {
+            signal->completion = new writeCompletion;
+            signal->completion->callback = Persistent<Function>::New(Local<Function>::Cast(args[i]));
+            break;
+        }
+    }
+
+    if (id == -1) {
+        CompleteWrite(signal->completion, WRITE_UNKNOWN_SIGNAL, 0);
+        delete signal;
+        return Undefined();
+    }
+
+    queue<canSignal*>* writeQueue = lsWriteQueue;
+    uv_mutex_t* writeQueueLock = lsWriteQueueLock;
+    uv_cond_t* writeQueueNotEmpty = lsWriteQueueNotEmpty;
+    if (definitions.current.load()->writes[id].bus == BUS_HS) {
+        writeQueue = hsWriteQueue;
+        writeQueueLock = hsWriteQueueLock;
+        writeQueueNotEmpty = hsWriteQueueNotEmpty;
+    }
+
+    // Lock writeQueue
+    uv_mutex_lock(writeQueueLock);
+
+    writeQueue->push(signal);
+
+    uv_mutex_unlock(writeQueueLock);   
+
+    uv_cond_signal(writeQueueNotEmpty);
+
+    return Undefined();
+}
+
+// Returns the id of a write signal on a bus, or -1
+int FindWriteSignal(Handle<Value> name, int bus) {
+    String::Utf8Value param0(name->ToString());
+    auto it = registry.writeIds.find(std::string(*param0));
+    definitionTable* table = definitions.current.load();
+    if (it == registry.writeIds.end() || it->second >= (int) table->writes.size() ||
+        table->writes[it->second].bus != bus) {
+        return -1;
+    }
+    return it->second;
+}
+
+Handle<Value> Write(const Arguments& args) {
+
+    // All V8 functions need a scope
+    HandleScope scope;
+
+    return scope.Close(QueueWrite(args, FindWriteSignal(args[0], BUS_LS)));
+}
+
+Handle<Value> WriteHs(const Arguments& args) {
+
+    // All V8 functions need a scope
+    HandleScope scope;
+
+    return scope.Close(QueueWrite(args, FindWriteSignal(args[0], BUS_HS)));
+}
+
+/*
+    Writes by signal id (see signalIds), skipping all string handling.
+    Args are the same as write's, with an id instead of a name.
+*/
+Handle<Value> WriteId(const Arguments& args) {
+
+    // All V8 functions need a scope
+    HandleScope scope;
+
+    int id = args.Length() > 0 ? args[0]->Int32Value() : -1;
+    definitionTable* table = definitions.current.load();
+    if (id < 0 || id >= (int) table->writes.size() || table->writes[id].bus == -1) {
+        id = -1;
+    }
+    return scope.Close(QueueWrite(args, id));
+}
+
+/*
+    Returns the signal ids, as { read: { name: id }, ls: { name: id }, hs: { name: id } }
+    with the write signals currently defined split by bus.
+*/
+Handle<Value> SignalIds(const Arguments& args) {
+
+    // All V8 functions need a scope
+    HandleScope scope;
+
+    Local<Object> read = Object::New();
+    for (size_t id = 0; id < registry.names.size(); id++) {
+        read->Set(registry.v8Names[id], Integer::New(id));
+    }
+
+    Local<Object> ls = Object::New();
+    Local<Object> hs = Object::New();
+    definitionTable* table = definitions.current.load();
+    for (size_t id = 0; id < table->writes.size(); id++) {
+        if (table->writes[id].bus != -1) {
+            Local<Object> bus = table->writes[id].bus == BUS_HS ? hs : ls;
+            bus->Set(String::New(table->writes[id].name.c_str()), Integer::New(id));
+        }
+    }
+
+    Local<Object> ids = Object::New();
+    ids->Set(String::NewSymbol("read"), read);
+    ids->Set(String::NewSymbol("ls"), ls);
+    ids->Set(String::NewSymbol("hs"), hs);
+    return scope.Close(ids);
+}
+
+// Returns the id of a read signal, or -1
+int FindReadSignal(Handle<Value> name) {
+    String::Utf8Value param(name->ToString());
+    auto it = registry.ids.find(std::string(*param));
+    return it == registry.ids.end() ? -1 : it->second;
+}
+
+/*
+    Starts decoding a signal. Calls are counted, so each one needs a matching unsubscribe.
+    Args should contain a signal name.
+*/
+Handle<Value> Subscribe(const Arguments& args) {
+
+    // All V8 functions need a scope
+    HandleScope scope;
+
+    if (args.Length() < 1) {
+      return ThrowException(Exception::TypeError(String::New("You must pass a signal name")));
+    }
+
+    String::Utf8Value param0(args[0]->ToString());
+
+    // Signals that aren't defined yet get an id too, in case a reload adds them
+    uv_mutex_lock(&subscriptions.lock);
+    int id = InternReadSignal(std::string(*param0));
+    if ((int) subscriptions.counts.size() <= id) {
+        subscriptions.counts.resize(id + 1, 0);
+    }
+    if (subscriptions.counts[id]++ == 0) {
+        subscriptions.version++;
+    }
+    uv_mutex_unlock(&subscriptions.lock);
+
+    return Undefined();
+}
+
+/*
+    Stops decoding a signal once every subscribe has been matched.
+    Args should contain a signal name.
+*/
+Handle<Value> Unsubscribe(const Arguments& args) {
+
+    // All V8 functions need a scope
+    HandleScope scope;
+
+    if (args.Length() < 1) {
+      return ThrowException(Exception::TypeError(String::New("You must pass a signal name")));
+    }
+
+    int id = FindReadSignal(args[0]);
+
+    uv_mutex_lock(&subscriptions.lock);
+    if (id != -1 && id < (int) subscriptions.counts.size() && subscriptions.counts[id] > 0) {
+        if (--subscriptions.counts[id] == 0) {
+            subscriptions.version++;
+        }
+    }
+    uv_mutex_unlock(&subscriptions.lock);
+
+    return Undefined();
+}
+
+/*
+    Aggregates a signal natively instead of passing on every sample, separately for each
+    J1939 source address.
+    Args should contain a signal name, a window length and optionally a slide (both in ms).
+    The slide defaults to the window (a tumbling window) and must divide it.
+*/
+Handle<Value> Aggregate(const Arguments& args) {
+
+    // All V8 functions need a scope
+    HandleScope scope;
+
+    if (args.Length() < 2) {
+      return ThrowException(Exception::TypeError(String::New("You must pass a signal name and a window")));
+    }
+
+    aggregationDef def;
+    def.window = args[1]->IntegerValue();
+    def.slide = args.Length() > 2 && !args[2]->IsUndefined() ? args[2]->IntegerValue() : def.window;
+    if (args[1]->IntegerValue() <= 0 || (args.Length() > 2 && !args[2]->IsUndefined() && args[2]->IntegerValue() <= 0) ||
+        def.window % def.slide != 0 || def.window / def.slide > MAX_AGGREGATE_PANES) {
+      return ThrowException(Exception::RangeError(String::New("The slide must be positive and divide the window")));
+    }
+
+    String::Utf8Value param0(args[0]->ToString());
+
+    uv_mutex_lock(&subscriptions.lock);
+    int id = InternReadSignal(std::string(*param0));
+    subscriptions.aggregations[id] = def;
+    subscriptions.version++;
+    uv_mutex_unlock(&subscriptions.lock);
+
+    return Undefined();
+}
+
+/*
+    Stops aggregating a signal.
+    Args should contain a signal name.
+*/
+Handle<Value> Unaggregate(const Arguments& args) {
+
+    // All V8 functions need a scope
+    HandleScope scope;
+
+    if (args.Length() < 1) {
+      return ThrowException(Exception::TypeError(String::New("You must pass a signal name")));
+    }
+
+    int id = FindReadSignal(args[0]);
+
+    uv_mutex_lock(&subscriptions.lock);
+    if (subscriptions.aggregations.erase(id) != 0) {
+        subscriptions.version++;
+    }
+    uv_mutex_unlock(&subscriptions.lock);
+
+    return Undefined();
+}
+
+// Reads a number from a definition into value. Missing optional numbers keep their default.
+bool DefinitionNumber(Handle<Object> def, const char* key, double& value, bool required) {
+    Local<Value> v = def->Get(String::NewSymbol(key));
+    if (v->IsUndefined() && !required) {
+        return true;
+    }
+    if (!v->IsNumber()) {
+        return false;
+    }
+    value = v->NumberValue();
+    return true;
+}
+
+/*
+  Parses an array of read definitions, like
+  { id: 1954, name: 'batteryVoltage', startBit: 36, length: 12, scale: 0.25, offset: 0,
+    unit: 'volts', signed: false, extended: false }, into m, keyed by id (the PGN on a
+  J1939 bus). scale, offset, unit, signed and extended are optional. Extended GMLAN ids
+  can be given as received, they're keyed like ReadSignalKey does.
+  Signals have to fit in the 64 bits ReadParse and J1939Parse decode from.
+  Returns an error message, or NULL.
+*/
+const char* ParseReadSignals(Handle<Value> value, int idFormat, readSignalMap& m) {
+    if (!value->IsArray()) {
+        return "Read definitions must be an array";
+    }
+    Local<Array> list = Local<Array>::Cast(value);
+    for (uint32_t i = 0; i < list->Length(); i++) {
+        if (!list->Get(i)->IsObject()) {
+            return "Read definitions must be objects";
+        }
+        Local<Object> def = list->Get(i)->ToObject();
+        Local<Value> name = def->Get(String::NewSymbol("name"));
+        double id, startBit, length, scale = 1, offset = 0;
+        if (!name->IsString() || !DefinitionNumber(def, "id", id, true) ||
+            !DefinitionNumber(def, "startBit", startBit, true) || !DefinitionNumber(def, "length", length, true) ||
+            !DefinitionNumber(def, "scale", scale, false) || !DefinitionNumber(def, "offset", offset, false)) {
+            return "Read definitions need a numeric id, startBit and length and a name";
+        }
+        if (id != floor(id) || startBit != floor(startBit) || length != floor(length)) {
+            return "Read definition ids, start bits and lengths must be integers";
+        }
+
+        // J1939 payloads can be longer than a frame, only the bytes a signal spans are decoded
+        bool isExtended = def->Get(String::NewSymbol("extended"))->BooleanValue();
+        bool isJ1939 = isExtended && idFormat == ID_FORMAT_J1939;
+        int spannedBits = isJ1939 ? (int) startBit % 8 + (int) length : (int) (startBit + length);
+        if (startBit < 0 || length < 1 || length > 63 || spannedBits > 64) {
+            return "Read signals must be 1 to 63 bits long and fit in 64 bits";
+        }
+
+        long key = (long) id;
+        if (!isExtended && (key < 0 || key > 0x7FF)) {
+            return "Standard ids must be 11 bits";
+        } else if (isJ1939 && (key < 0 || key > 0x3FFFF || J1939Pgn(key << 8) != key)) {
+            return "J1939 ids must be PGNs, without a destination address";
+        } else if (isExtended && !isJ1939) {
+            if (key < 0 || key > 0x1FFFFFFF) {
+                return "Extended ids must be 29 bits";
+            }
+            key = ReadSignalKey(idFormat, key, canMSG_EXT);
+        }
 
-        // Clean up
-        delete m;
+        Local<Value> unit = def->Get(String::NewSymbol("unit"));
+        String::Utf8Value nameValue(name);
+        String::Utf8Value unitValue(unit->IsUndefined() ? String::Empty() : unit->ToString());
+        m.insert(make_pair((int) key, signalDef(isExtended,
+            std::string(*nameValue), def->Get(String::NewSymbol("signed"))->BooleanValue(),
+            (int) startBit, (int) length, scale, offset, std::string(*unitValue))));
     }
+    return NULL;
 }
 
 /*
-  Constantly processes messages from writeQueue (never exits).
-  req->data should be a canProcessWriteBaton.
-  Does not need to run in the V8 thread.
+  Parses write definitions keyed by signal name, like
+  { hvacCommand: { id: 0x251, message: 0, startBit: 8, length: 2, priority: 2 } }, into m.
+  message defaults to 0, startBit to -1 (the value isn't used) and priority to normal.
+  Ids are standard (11 bit), and startBit has to fall within the message.
+  Returns an error message, or NULL.
 */
-void ProcessWriteMessages(void* arg) {
-
-    // Retrieve baton
-    canProcessWriteBaton* baton = (canProcessWriteBaton*) arg;
-        
-    while (1) {
-        // Lock writeQueue
-        uv_mutex_lock(baton->writeQueueLock);
-
-        // Wait for a message to come in
-        while (baton->writeQueue->empty()) {
-            uv_cond_wait(baton->writeQueueNotEmpty, baton->writeQueueLock);
+const char* ParseWriteSignals(Handle<Value> value, writeMessageMap& m) {
+    if (!value->IsObject()) {
+        return "Write definitions must be an object";
+    }
+    Local<Object> defs = value->ToObject();
+    Local<Array> names = defs->GetOwnPropertyNames();
+    for (uint32_t i = 0; i < names->Length(); i++) {
+        Local<Value> name = names->Get(i);
+        if (!defs->Get(name)->IsObject()) {
+            return "Write definitions must be objects";
+        }
+        Local<Object> def = defs->Get(name)->ToObject();
+        double id, length, message = 0, startBit = -1, priority = PRIORITY_NORMAL;
+        if (!DefinitionNumber(def, "id", id, true) || !DefinitionNumber(def, "length", length, true) ||
+            !DefinitionNumber(def, "message", message, false) || !DefinitionNumber(def, "startBit", startBit, false) ||
+            !DefinitionNumber(def, "priority", priority, false)) {
+            return "Write definitions need a numeric id and length";
+        }
+        if (id != floor(id) || length != floor(length) || message != floor(message) ||
+            startBit != floor(startBit) || priority != floor(priority)) {
+            return "Write definition numbers must be integers";
+        }
+        if (length < 0 || length > 8 || priority < PRIORITY_HIGH || priority > PRIORITY_LOW) {
+            return "Write messages must be 0 to 8 bytes long, with a known priority";
         }
 
-        // Pop the message information off the queue
-        canSignal* signal = baton->writeQueue->front();
-	    baton->writeQueue->pop();
-
-        // Unlock queue while we send the message
-        uv_mutex_unlock(baton->writeQueueLock);
-	
-        // Process Message
-        canMessage *m = WriteParse(baton->messageDefinitions, signal->name, signal->value);
-
-        // Lock processedQueue
-        uv_mutex_lock(baton->processedWriteQueueLock);
-	     
-        // Add message to processed queue
-        baton->processedWriteQueue->push(m);
-
-        if (baton->processedWriteQueue->size() > 80) {
-            printf("WARNING: There are %lu unprocessed messages\n", baton->processedWriteQueue->size());
+        // WriteParse shifts the value into the message and sends standard frames
+        if (startBit != -1 && (startBit < 0 || startBit >= 8 * length)) {
+            return "Write start bits must be -1 or within the message";
+        }
+        if (id < 0 || id > 0x7FF) {
+            return "Write ids must be 11 bits";
+        }
+        if (message < 0 || message >= ldexp(1.0, 8 * (int) length)) {
+            return "Write messages must fit in their length";
         }
-	
-        // Unlock processedWriteQueue while we go back to waiting for messages
-        // from JavaScript
-        uv_mutex_unlock(baton->processedWriteQueueLock);
 
-        // Let others know there is something to send
-        uv_cond_signal(baton->processedWriteQueueNotEmpty);
+        String::Utf8Value nameValue(name);
+        m.insert(make_pair(std::string(*nameValue),
+            messageDef((long) id, (unsigned long) message, (int) startBit, (int) length, (int) priority)));
     }
+    return NULL;
 }
 
 /*
-Constantly sends messages from processedWriteQueue.
-req->data should be a canReadBaton.
-Does not need to run in the V8 thread.
+    Replaces the signal definitions without stopping the bus threads, which pick the new
+    ones up (and update their acceptance filters) without blocking.
+    Args can contain an object with any of hs and ls (arrays of read definitions, see
+    ParseReadSignals) and writeHs and writeLs (write definitions, see ParseWriteSignals).
+    Parts left out keep their current definitions. With no args, the definitions in this
+    file are restored. Nothing changes if any definition is invalid.
 */
-void SendWriteMessages(void* arg) {
-        
-    // Retrieve baton
-    canWriteBaton* baton = (canWriteBaton*) arg;
-    canHandle handle = canOpenChannel(baton->channel, baton->canFlags);
-    if (handle < 0) {
-      printf("ERROR: canOpenChannel %d failed: %d\n", baton->channel, handle);
-      return;
-    }
-    canSetBusParams(handle, baton->baudRate, baton->tseg1, baton->tseg2, baton->sjw, baton->samplePoints, baton->syncMode);
-    canBusOn(handle);
+Handle<Value> ReloadDefinitions(const Arguments& args) {
 
-    while (1) {
+    // All V8 functions need a scope
+    HandleScope scope;
+
+    if (args.Length() < 1 || args[0]->IsUndefined()) {
+        uv_mutex_lock(&subscriptions.lock);
+        definitionTable* table = BuiltinDefinitions();
+        uv_mutex_unlock(&subscriptions.lock);
+        PublishDefinitions(table);
+        return Undefined();
+    }
 
-        // Lock processedWriteQueue
-        uv_mutex_lock(baton->processedWriteQueueLock);
+    if (!args[0]->IsObject()) {
+      return ThrowException(Exception::TypeError(String::New("You must pass an object of definitions")));
+    }
 
-        // Wait for a message to come in
-        while (baton->processedWriteQueue->empty()) {
-          uv_cond_wait(baton->processedWriteQueueNotEmpty, baton->processedWriteQueueLock);
+    // Parse everything before touching the registry
+    definitionTable* current = definitions.current.load();
+    Local<Object> defs = args[0]->ToObject();
+    const char* readKeys[2] = { "hs", "ls" };
+    const char* writeKeys[2] = { "writeHs", "writeLs" };
+    readSignalMap read[2] = { current->read[BUS_HS], current->read[BUS_LS] };
+    writeMessageMap writes[2];
+    bool replaceWrites[2] = { false, false };
+    for (int bus = BUS_HS; bus <= BUS_LS; bus++) {
+        const char* error = NULL;
+        if (defs->Has(String::NewSymbol(readKeys[bus]))) {
+            read[bus].clear();
+            int idFormat = bus == BUS_HS ? HS_ID_FORMAT : LS_ID_FORMAT;
+            error = ParseReadSignals(defs->Get(String::NewSymbol(readKeys[bus])), idFormat, read[bus]);
+        }
+        if (error == NULL && defs->Has(String::NewSymbol(writeKeys[bus]))) {
+            replaceWrites[bus] = true;
+            error = ParseWriteSignals(defs->Get(String::NewSymbol(writeKeys[bus])), writes[bus]);
         }
+        if (error != NULL) {
+            return ThrowException(Exception::TypeError(String::New(error)));
+        }
+    }
 
-        // Pop the message off the queue
-        canMessage* m = baton->processedWriteQueue->front();
-        baton->processedWriteQueue->pop();
+    definitionTable* table = new definitionTable;
+    table->writes = current->writes;
+    for (auto it = table->writes.begin(); it != table->writes.end(); ++it) {
+        if (it->bus != -1 && replaceWrites[it->bus]) {
+            it->bus = -1;
+        }
+    }
 
-        // Unlock queue while we send the message
-        uv_mutex_unlock(baton->processedWriteQueueLock);
+    uv_mutex_lock(&subscriptions.lock);
+    for (int bus = BUS_HS; bus <= BUS_LS; bus++) {
+        table->read[bus] = read[bus];
+        RegisterReadSignals(table->read[bus]);
+        RegisterWriteSignals(table, writes[bus], bus);
+    }
+    uv_mutex_unlock(&subscriptions.lock);
 
-        // send the message
-        canWrite(handle, m->id, m->data, m->length, canMSG_STD);
+    PublishDefinitions(table);
 
-        // Clean up
-        delete m;
-    }
+    return Undefined();
 }
 
-Handle<Value> Write(const Arguments& args) {
+/*
+    Starts the bus analyzers, which measure every frame on both buses (opening up the
+    acceptance filters) and take a snapshot of the bus load and each id's timing every
+    interval ms. Args should contain the interval and a callback for the snapshots.
+    Calling it again changes the interval and callback.
+*/
+Handle<Value> StartAnalyzer(const Arguments& args) {
 
     // All V8 functions need a scope
     HandleScope scope;
 
-    if (args.Length() < 2) {
-      return ThrowException(Exception::TypeError(String::New("You must pass two arguments")));       
+    if (args.Length() < 2 || !args[1]->IsFunction()) {
+      return ThrowException(Exception::TypeError(String::New("You must pass an interval and a callback")));
+    }
+    if (args[0]->IntegerValue() <= 0) {
+      return ThrowException(Exception::RangeError(String::New("The interval must be positive")));
     }
 
-    canSignal* signal = new canSignal;
+    if (!busSnapshots.callback.IsEmpty()) {
+        busSnapshots.callback.Dispose();
+    }
+    busSnapshots.callback = Persistent<Function>::New(Local<Function>::Cast(args[1]));
 
-    String::Utf8Value param0(args[0]->ToString());
-    signal->name = std::string(*param0);    
-    signal->value = args[1]->ToInteger()->Value();
+    // Have the bus threads open their filters
+    if (analyzerInterval.exchange(args[0]->IntegerValue()) == 0) {
+        subscriptions.version++;
+    }
 
-    // Lock lsWriteQueue
-    uv_mutex_lock(lsWriteQueueLock);
+    return Undefined();
+}
 
-    lsWriteQueue->push(signal);
+// Stops the bus analyzers
+Handle<Value> StopAnalyzer(const Arguments& args) {
 
-    uv_mutex_unlock(lsWriteQueueLock);   
+    // All V8 functions need a scope
+    HandleScope scope;
 
-    uv_cond_signal(lsWriteQueueNotEmpty);
+    if (analyzerInterval.exchange(0) != 0) {
+        subscriptions.version++;
+    }
+    if (!busSnapshots.callback.IsEmpty()) {
+        busSnapshots.callback.Dispose();
+        busSnapshots.callback.Clear();
+    }
 
     return Undefined();
-
 }
 
-Handle<Value> WriteHs(const Arguments& args) {
+/*
+    Opens the raw frame tap (see rawFrameTap), shared by every caller.
+    Args should contain whether to include frames we send and a callback, called at most
+    once per batch of new frames. Returns a Buffer over the tap. Frames we send are in the
+    ring while any open caller asked for them, the others have to skip them.
+*/
+Handle<Value> OpenRawTap(const Arguments& args) {
 
     // All V8 functions need a scope
     HandleScope scope;
 
-    if (args.Length() < 2) {
-      return ThrowException(Exception::TypeError(String::New("You must pass two arguments")));       
+    if (args.Length() < 2 || !args[1]->IsFunction()) {
+      return ThrowException(Exception::TypeError(String::New("You must pass includeTx and a callback")));
     }
 
-    canSignal* signal = new canSignal;
-
-    String::Utf8Value param0(args[0]->ToString());
-    signal->name = std::string(*param0);    
-    signal->value = args[1]->ToInteger()->Value();
-
-    // Lock hsWriteQueue
-    uv_mutex_lock(hsWriteQueueLock);
+    rawFrameTap* tap = rawTapStorage;
+    if (tap == NULL) {
+        size_t size = RAW_TAP_HEADER_SIZE + RAW_TAP_FRAMES * RAW_TAP_RECORD_SIZE;
+        tap = new rawFrameTap;
+        tap->memory = new char[size];
+        memset(tap->memory, 0, size);
+        uint32_t header[] = { 0, RAW_TAP_FRAMES, RAW_TAP_RECORD_SIZE, 0 };
+        memcpy(tap->memory, header, sizeof(header));
+        tap->includeTx = false;
+        tap->txOpeners = 0;
+        uv_mutex_init(&tap->lock);
+        rawTapStorage = tap;
+    }
 
-    hsWriteQueue->push(signal);
+    rawTapCallbackBaton* callbackBaton = new rawTapCallbackBaton;
+    callbackBaton->callback = Persistent<Function>::New(Local<Function>::Cast(args[1]));
+    callbackBaton->context = Persistent<Object>::New(args.This());
+    callbackBaton->includeTx = args[0]->BooleanValue();
 
-    uv_mutex_unlock(hsWriteQueueLock);   
+    uv_async_t* async = new uv_async_t;
+    async->data = (void*) callbackBaton;
+    uv_async_init(uv_default_loop(), async, ExecuteRawTapCallback);
 
-    uv_cond_signal(hsWriteQueueNotEmpty);
+    uv_mutex_lock(&tap->lock);
+    tap->asyncs.push_back(async);
+    if (callbackBaton->includeTx) {
+        tap->txOpeners++;
+    }
+    tap->includeTx = tap->txOpeners > 0;
+    uv_mutex_unlock(&tap->lock);
+
+    // Publish the tap and make the readers open their acceptance filters
+    if (rawTap.load() == NULL) {
+        rawTap.store(tap);
+        uv_mutex_lock(&subscriptions.lock);
+        subscriptions.version++;
+        uv_mutex_unlock(&subscriptions.lock);
+    }
 
-    return Undefined();
+    node::Buffer* buffer = node::Buffer::New(tap->memory, RAW_TAP_HEADER_SIZE + RAW_TAP_FRAMES * RAW_TAP_RECORD_SIZE, RawTapFree, NULL);
+    return scope.Close(buffer->handle_);
+}
 
+// Frees a raw frame tap callback once its async is closed
+void RawTapCallbackClosed(uv_handle_t* handle) {
+    rawTapCallbackBaton* baton = (rawTapCallbackBaton*) handle->data;
+    baton->callback.Dispose();
+    baton->context.Dispose();
+    delete baton;
+    delete (uv_async_t*) handle;
 }
 
 /*
-    Starts up all of our threads.
-    Args should contain a callback function.
+    Closes a raw frame tap opened by openRawTap. Args should contain the callback it was
+    opened with. Once the last one is closed the readers go back to their acceptance filters.
+    The tap's memory is kept for the Buffers over it and reused by the next openRawTap.
 */
-Handle<Value> Start(const Arguments& args) {
+Handle<Value> CloseRawTap(const Arguments& args) {
 
     // All V8 functions need a scope
     HandleScope scope;
 
+    rawFrameTap* tap = rawTap.load();
+    if (args.Length() < 1 || !args[0]->IsFunction()) {
+      return ThrowException(Exception::TypeError(String::New("You must pass the callback the tap was opened with")));
+    }
+    if (tap == NULL) {
+      return ThrowException(Exception::RangeError(String::New("The raw frame tap isn't open")));
+    }
+
+    uv_async_t* async = NULL;
+    uv_mutex_lock(&tap->lock);
+    for (auto it = tap->asyncs.begin(); it != tap->asyncs.end(); ++it) {
+        rawTapCallbackBaton* baton = (rawTapCallbackBaton*) (*it)->data;
+        if (baton->callback->StrictEquals(args[0])) {
+            async = *it;
+            tap->asyncs.erase(it);
+            if (baton->includeTx) {
+                tap->txOpeners--;
+            }
+            break;
+        }
+    }
+    tap->includeTx = tap->txOpeners > 0;
+    bool closed = tap->asyncs.empty();
+    uv_mutex_unlock(&tap->lock);
+
+    if (async == NULL) {
+      return ThrowException(Exception::RangeError(String::New("The raw frame tap isn't open for that callback")));
+    }
+    uv_close((uv_handle_t*) async, RawTapCallbackClosed);
+
+    // Have the readers tighten their acceptance filters again
+    if (closed) {
+        rawTap.store(NULL);
+        uv_mutex_lock(&subscriptions.lock);
+        subscriptions.version++;
+        uv_mutex_unlock(&subscriptions.lock);
+    }
+
+    return Undefined();
+}
+
+/*
+    Starts up all of the bus threads.
+*/
+void StartBusThreads() {
+
     // Initialize HS read synchronization
     queue<canMessage*>* hsReadQueue = new queue<canMessage*>();
     uv_mutex_t* hsReadQueueLock = new uv_mutex_t;
@@ -644,27 +3167,11 @@ Handle<Value> Start(const Arguments& args) {
     uv_mutex_init(lsReadQueueLock);
     uv_cond_init(lsReadQueueNotEmpty);
 
-    // Initialize read processed synchronization
-    queue<canSignal*>* processedReadQueue = new queue<canSignal*>();
-    uv_mutex_t* processedReadQueueLock = new uv_mutex_t;
-    uv_mutex_init(processedReadQueueLock);
-
-    // Initialize processedReadAsync baton
-    canReadCallbackBaton* processedReadAsyncBaton = new canReadCallbackBaton;
-    processedReadAsyncBaton->processedReadQueue = processedReadQueue;
-    processedReadAsyncBaton->processedReadQueueLock = processedReadQueueLock;
-    processedReadAsyncBaton->callback = Persistent<Function>::New(Local<Function>::Cast(args[0]));
-
-    // Initialize processedReadAsync
-    uv_async_t* processedReadAsync = new uv_async_t;
-    processedReadAsync->data = (void*) processedReadAsyncBaton;
-
-    // Initialize LS processed write synchronization
-    queue<canMessage*>* lsProcessedWriteQueue = new queue<canMessage*>();
-    uv_mutex_t* lsProcessedWriteQueueLock = new uv_mutex_t;
-    uv_cond_t* lsProcessedWriteQueueNotEmpty = new uv_cond_t;
-    uv_mutex_init(lsProcessedWriteQueueLock);
-    uv_cond_init(lsProcessedWriteQueueNotEmpty);
+    // Initialize LS transmit scheduler
+    transmitScheduler* lsScheduler = new transmitScheduler;
+    lsScheduler->sequence = 0;
+    uv_mutex_init(&lsScheduler->lock);
+    uv_cond_init(&lsScheduler->notEmpty);
 
     // Initialize LS gloabl write synchronization
     lsWriteQueue = new queue<canSignal*>();
@@ -673,12 +3180,11 @@ Handle<Value> Start(const Arguments& args) {
     uv_mutex_init(lsWriteQueueLock);
     uv_cond_init(lsWriteQueueNotEmpty);
 
-    // Initialize HS processed write synchronization
-    queue<canMessage*>* hsProcessedWriteQueue = new queue<canMessage*>();
-    uv_mutex_t* hsProcessedWriteQueueLock = new uv_mutex_t;
-    uv_cond_t* hsProcessedWriteQueueNotEmpty = new uv_cond_t;
-    uv_mutex_init(hsProcessedWriteQueueLock);
-    uv_cond_init(hsProcessedWriteQueueNotEmpty);
+    // Initialize HS transmit scheduler
+    transmitScheduler* hsScheduler = new transmitScheduler;
+    hsScheduler->sequence = 0;
+    uv_mutex_init(&hsScheduler->lock);
+    uv_cond_init(&hsScheduler->notEmpty);
 
     // Initialize HS gloabl write synchronization
     hsWriteQueue = new queue<canSignal*>();
@@ -689,7 +3195,11 @@ Handle<Value> Start(const Arguments& args) {
 
     // Initialize HS read baton
     canReadBaton* hsCanReadBaton = new canReadBaton;
-    hsCanReadBaton->signalDefinitions = createHsReadSignalMap();
+    hsCanReadBaton->bus = BUS_HS;
+    hsCanReadBaton->idFormat = HS_ID_FORMAT;
+    hsCanReadBaton->subscriptionVersion = -1;
+    hsCanReadBaton->definitionsEpoch = -1;
+    hsCanReadBaton->definitionsReader = AddDefinitionReader();
     hsCanReadBaton->channel = HS_CHANNEL;
     hsCanReadBaton->baudRate = HS_BAUD;
     hsCanReadBaton->tseg1 = HS_TSEG1;
@@ -704,7 +3214,11 @@ Handle<Value> Start(const Arguments& args) {
 
     // Initialize LS read baton
     canReadBaton* lsCanReadBaton = new canReadBaton;
-    lsCanReadBaton->signalDefinitions = createLsReadSignalMap();
+    lsCanReadBaton->bus = BUS_LS;
+    lsCanReadBaton->idFormat = LS_ID_FORMAT;
+    lsCanReadBaton->subscriptionVersion = -1;
+    lsCanReadBaton->definitionsEpoch = -1;
+    lsCanReadBaton->definitionsReader = AddDefinitionReader();
     lsCanReadBaton->channel = LS_CHANNEL;
     lsCanReadBaton->baudRate = LS_BAUD;
     lsCanReadBaton->tseg1 = LS_TSEG1;
@@ -719,23 +3233,25 @@ Handle<Value> Start(const Arguments& args) {
 
     // Initialize HS read process baton
     canProcessReadBaton* canHsProcessReadBaton = new canProcessReadBaton;
-    canHsProcessReadBaton->signalDefinitions = createHsReadSignalMap();
+    canHsProcessReadBaton->bus = BUS_HS;
+    canHsProcessReadBaton->idFormat = HS_ID_FORMAT;
+    canHsProcessReadBaton->subscriptionVersion = -1;
+    canHsProcessReadBaton->definitionsEpoch = -1;
+    canHsProcessReadBaton->definitionsReader = AddDefinitionReader();
     canHsProcessReadBaton->readQueue = hsReadQueue;
     canHsProcessReadBaton->readQueueLock = hsReadQueueLock;
     canHsProcessReadBaton->readQueueNotEmpty = hsReadQueueNotEmpty;
-    canHsProcessReadBaton->processedReadQueue = processedReadQueue;
-    canHsProcessReadBaton->processedReadQueueLock = processedReadQueueLock;
-    canHsProcessReadBaton->processedReadAsync = processedReadAsync;
 
     // Initialize LS read process baton
     canProcessReadBaton* canLsProcessReadBaton = new canProcessReadBaton;
-    canLsProcessReadBaton->signalDefinitions = createLsReadSignalMap();
+    canLsProcessReadBaton->bus = BUS_LS;
+    canLsProcessReadBaton->idFormat = LS_ID_FORMAT;
+    canLsProcessReadBaton->subscriptionVersion = -1;
+    canLsProcessReadBaton->definitionsEpoch = -1;
+    canLsProcessReadBaton->definitionsReader = AddDefinitionReader();
     canLsProcessReadBaton->readQueue = lsReadQueue;
     canLsProcessReadBaton->readQueueLock = lsReadQueueLock;
     canLsProcessReadBaton->readQueueNotEmpty = lsReadQueueNotEmpty;
-    canLsProcessReadBaton->processedReadQueue = processedReadQueue;
-    canLsProcessReadBaton->processedReadQueueLock = processedReadQueueLock;
-    canLsProcessReadBaton->processedReadAsync = processedReadAsync;
 
     // Initialize HS read work request
     uv_work_t* hsReadReq = new uv_work_t();
@@ -755,13 +3271,12 @@ Handle<Value> Start(const Arguments& args) {
 
     // Initialize LS write process baton
     canProcessWriteBaton* lsCanProcessWriteBaton = new canProcessWriteBaton;
-    lsCanProcessWriteBaton->messageDefinitions = createLsWriteMessageMap();
+    lsCanProcessWriteBaton->bus = BUS_LS;
+    lsCanProcessWriteBaton->definitionsReader = AddDefinitionReader();
     lsCanProcessWriteBaton->writeQueue = lsWriteQueue;
     lsCanProcessWriteBaton->writeQueueLock = lsWriteQueueLock;
     lsCanProcessWriteBaton->writeQueueNotEmpty = lsWriteQueueNotEmpty;
-    lsCanProcessWriteBaton->processedWriteQueue = lsProcessedWriteQueue;
-    lsCanProcessWriteBaton->processedWriteQueueLock = lsProcessedWriteQueueLock;
-    lsCanProcessWriteBaton->processedWriteQueueNotEmpty = lsProcessedWriteQueueNotEmpty;
+    lsCanProcessWriteBaton->scheduler = lsScheduler;
 
     // Initialize LS write baton
     canWriteBaton* lsCanWriteBaton = new canWriteBaton;
@@ -773,19 +3288,16 @@ Handle<Value> Start(const Arguments& args) {
     lsCanWriteBaton->samplePoints = LS_SAMPLE_POINTS;
     lsCanWriteBaton->syncMode = LS_SYNC_MODE;
     lsCanWriteBaton->canFlags = LS_FLAGS;
-    lsCanWriteBaton->processedWriteQueue = lsProcessedWriteQueue;
-    lsCanWriteBaton->processedWriteQueueLock = lsProcessedWriteQueueLock;
-    lsCanWriteBaton->processedWriteQueueNotEmpty = lsProcessedWriteQueueNotEmpty;
+    lsCanWriteBaton->scheduler = lsScheduler;
 
     // Initialize HS write process baton
     canProcessWriteBaton* hsCanProcessWriteBaton = new canProcessWriteBaton;
-    hsCanProcessWriteBaton->messageDefinitions = createHsWriteMessageMap();
+    hsCanProcessWriteBaton->bus = BUS_HS;
+    hsCanProcessWriteBaton->definitionsReader = AddDefinitionReader();
     hsCanProcessWriteBaton->writeQueue = hsWriteQueue;
     hsCanProcessWriteBaton->writeQueueLock = hsWriteQueueLock;
     hsCanProcessWriteBaton->writeQueueNotEmpty = hsWriteQueueNotEmpty;
-    hsCanProcessWriteBaton->processedWriteQueue = hsProcessedWriteQueue;
-    hsCanProcessWriteBaton->processedWriteQueueLock = hsProcessedWriteQueueLock;
-    hsCanProcessWriteBaton->processedWriteQueueNotEmpty = hsProcessedWriteQueueNotEmpty;
+    hsCanProcessWriteBaton->scheduler = hsScheduler;
 
     // Initialize HS write baton
     canWriteBaton* hsCanWriteBaton = new canWriteBaton;
@@ -797,9 +3309,7 @@ Handle<Value> Start(const Arguments& args) {
     hsCanWriteBaton->samplePoints = HS_SAMPLE_POINTS;
     hsCanWriteBaton->syncMode = HS_SYNC_MODE;
     hsCanWriteBaton->canFlags = HS_FLAGS;
-    hsCanWriteBaton->processedWriteQueue = hsProcessedWriteQueue;
-    hsCanWriteBaton->processedWriteQueueLock = hsProcessedWriteQueueLock;
-    hsCanWriteBaton->processedWriteQueueNotEmpty = hsProcessedWriteQueueNotEmpty;
+    hsCanWriteBaton->scheduler = hsScheduler;
 
     // Initialize LS process work request
     uv_work_t* lsProcessWriteReq = new uv_work_t();
@@ -818,9 +3328,6 @@ Handle<Value> Start(const Arguments& args) {
     hsWriteReq->data = (void*) hsCanWriteBaton;
      
     // Start all our threads        
-    uv_loop_t* loop = uv_default_loop();
-    uv_async_init(loop, processedReadAsync, ExecuteCallbacks);
-
     uv_thread_t lsReadId;
     uv_thread_t lsReadProcessId;
     uv_thread_create(&lsReadId, ReadMessages, lsCanReadBaton);
@@ -840,6 +3347,341 @@ Handle<Value> Start(const Arguments& args) {
     uv_thread_t hsWriteSendId;
     uv_thread_create(&hsWriteProcessId, ProcessWriteMessages, hsCanProcessWriteBaton);
     uv_thread_create(&hsWriteSendId, SendWriteMessages, hsCanWriteBaton);
+}
+
+/*
+    Starts passing decoded signals to JavaScript, starting the bus threads if startLog
+    hasn't. Args should contain a callback function, and optionally a callback for
+    aggregates. Can only be called once.
+*/
+Handle<Value> Start(const Arguments& args) {
+
+    // All V8 functions need a scope
+    HandleScope scope;
+
+    if (args.Length() < 1 || !args[0]->IsFunction()) {
+      return ThrowException(Exception::TypeError(String::New("You must pass a callback")));
+    }
+    if (subscriptions.callbacks != NULL) {
+      return ThrowException(Exception::Error(String::New("Already started")));
+    }
+
+    // Initialize read processed synchronization
+    queue<canSignal*>* processedReadQueue = new queue<canSignal*>();
+    queue<signalAggregate*>* processedAggregateQueue = new queue<signalAggregate*>();
+    uv_mutex_t* processedReadQueueLock = new uv_mutex_t;
+    uv_mutex_init(processedReadQueueLock);
+
+    // Initialize processedReadAsync
+    uv_async_t* processedReadAsync = new uv_async_t;
+
+    // Initialize processedReadAsync baton
+    canReadCallbackBaton* processedReadAsyncBaton = new canReadCallbackBaton;
+    processedReadAsyncBaton->processedReadQueue = processedReadQueue;
+    processedReadAsyncBaton->processedAggregateQueue = processedAggregateQueue;
+    processedReadAsyncBaton->processedReadQueueLock = processedReadQueueLock;
+    processedReadAsyncBaton->processedReadAsync = processedReadAsync;
+    processedReadAsyncBaton->context = Persistent<Object>::New(args.This());
+    processedReadAsyncBaton->callback = Persistent<Function>::New(Local<Function>::Cast(args[0]));
+    if (args.Length() > 1 && args[1]->IsFunction()) {
+        processedReadAsyncBaton->aggregateCallback = Persistent<Function>::New(Local<Function>::Cast(args[1]));
+    }
+
+    processedReadAsync->data = (void*) processedReadAsyncBaton;
+    uv_async_init(uv_default_loop(), processedReadAsync, ExecuteCallbacks);
+
+    // Let the processing threads know where to send signals
+    uv_mutex_lock(&subscriptions.lock);
+    subscriptions.callbacks = processedReadAsyncBaton;
+    subscriptions.version++;
+    uv_mutex_unlock(&subscriptions.lock);
+
+    if (!busThreadsStarted) {
+        busThreadsStarted = true;
+        StartBusThreads();
+    }
+
+    return Undefined();
+}
+
+/*
+    Starts logging signals to a file (see signalLogger), replacing it if it exists, and
+    starts the bus threads if start hasn't. Args should contain the path and an
+    array of signal names. Only one log can be open at a time.
+*/
+Handle<Value> StartLog(const Arguments& args) {
+
+    // All V8 functions need a scope
+    HandleScope scope;
+
+    if (args.Length() < 2 || !args[1]->IsArray()) {
+      return ThrowException(Exception::TypeError(String::New("You must pass a path and an array of signal names")));
+    }
+    if (logger != NULL) {
+      return ThrowException(Exception::Error(String::New("A signal log is already open")));
+    }
+
+    // One offset per bus for the whole log, so chunks stay in driver time order
+    long long timeOffset[2];
+    if (!DriverTimeOffset(HS_CHANNEL, HS_FLAGS, timeOffset[BUS_HS]) ||
+        !DriverTimeOffset(LS_CHANNEL, LS_FLAGS, timeOffset[BUS_LS])) {
+      return ThrowException(Exception::Error(String::New("Can't read the driver clock")));
+    }
+
+    String::Utf8Value path(args[0]->ToString());
+    int fd = open(*path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      return ThrowException(Exception::Error(String::New(strerror(errno))));
+    }
+
+    signalLogger* l = new signalLogger;
+    l->fd = fd;
+    l->timeOffset[BUS_HS] = timeOffset[BUS_HS];
+    l->timeOffset[BUS_LS] = timeOffset[BUS_LS];
+    l->stopping = false;
+    l->pending.append(LOG_MAGIC, sizeof(LOG_MAGIC));
+
+    // Name every signal before any of its chunks
+    Local<Array> names = Local<Array>::Cast(args[1]);
+    vector<int> ids;
+    uv_mutex_lock(&subscriptions.lock);
+    for (uint32_t i = 0; i < names->Length(); i++) {
+        String::Utf8Value name(names->Get(i)->ToString());
+        int id = InternReadSignal(std::string(*name));
+        ids.push_back(id);
+        l->pending.push_back(LOG_RECORD_NAME);
+        l->pending.push_back(0);
+        AppendLittleEndian(l->pending, id, 2);
+        AppendLittleEndian(l->pending, name.length(), 2);
+        l->pending.append(*name, name.length());
+    }
+    uv_mutex_unlock(&subscriptions.lock);
+
+    uv_thread_create(&l->writer, WriteLog, l);
+
+    uv_mutex_lock(&logLock);
+    logger = l;
+    uv_mutex_unlock(&logLock);
+
+    // Have the bus threads decode the logged signals
+    uv_mutex_lock(&subscriptions.lock);
+    for (auto it = ids.begin(); it != ids.end(); ++it) {
+        if ((int) loggedSignals.size() <= *it) {
+            loggedSignals.resize(*it + 1, false);
+        }
+        loggedSignals[*it] = true;
+    }
+    subscriptions.version++;
+    uv_mutex_unlock(&subscriptions.lock);
+
+    if (!busThreadsStarted) {
+        busThreadsStarted = true;
+        StartBusThreads();
+    }
+
+    return Undefined();
+}
+
+/*
+  Waits for a stopped signal logger's writer to write out what's left, then closes the file.
+  Does not need to run in the V8 thread.
+*/
+void FinishLog(uv_work_t* req) {
+    signalLogger* l = ((logWorkBaton*) req->data)->logger;
+    if (l == NULL) {
+        return;
+    }
+
+    uv_thread_join(&l->writer);
+    close(l->fd);
+    for (auto it = l->encoders.begin(); it != l->encoders.end(); ++it) {
+        delete it->second;
+    }
+    delete l;
+}
+
+// Calls back stopLog once the log is closed. Must run in the V8 thread.
+void AfterFinishLog(uv_work_t* req, int status /*UNUSED*/) {
+
+    HandleScope scope;
+
+    logWorkBaton* baton = (logWorkBaton*) req->data;
+    if (!baton->callback.IsEmpty()) {
+        TryCatch tryCatch;
+        baton->callback->Call(Context::GetCurrent()->Global(), 0, NULL);
+        if (tryCatch.HasCaught()) {
+            node::FatalException(tryCatch);
+        }
+        baton->callback.Dispose();
+    }
+    delete baton;
+}
+
+/*
+    Stops logging signals. What's left is written out and the file closed off the V8 thread.
+    Args can contain a callback for when the file is closed.
+*/
+Handle<Value> StopLog(const Arguments& args) {
+
+    // All V8 functions need a scope
+    HandleScope scope;
+
+    uv_mutex_lock(&subscriptions.lock);
+    loggedSignals.clear();
+    subscriptions.version++;
+    uv_mutex_unlock(&subscriptions.lock);
+
+    uv_mutex_lock(&logLock);
+    signalLogger* l = logger;
+    logger = NULL;
+    if (l != NULL) {
+        l->stopping = true;
+        uv_cond_signal(&logNotEmpty);
+    }
+    uv_mutex_unlock(&logLock);
+
+    logWorkBaton* baton = new logWorkBaton;
+    baton->request.data = (void*) baton;
+    baton->logger = l;
+    if (args.Length() > 0 && args[0]->IsFunction()) {
+        baton->callback = Persistent<Function>::New(Local<Function>::Cast(args[0]));
+    }
+    uv_queue_work(uv_default_loop(), &baton->request, FinishLog, AfterFinishLog);
+
+    return Undefined();
+}
+
+/*
+  Reads and decodes the signal log at the baton's path, setting its error if it can't.
+  Does not need to run in the V8 thread.
+*/
+void ReadLogFile(uv_work_t* req) {
+
+    logWorkBaton* baton = (logWorkBaton*) req->data;
+
+    FILE* file = fopen(baton->path.c_str(), "rb");
+    if (file == NULL) {
+        baton->error = strerror(errno);
+        return;
+    }
+    string contents;
+    char buffer[LOG_WRITE_SIZE];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        contents.append(buffer, n);
+    }
+    fclose(file);
+
+    const unsigned char* data = (const unsigned char*) contents.data();
+    size_t size = contents.size();
+    if (size < sizeof(LOG_MAGIC) || memcmp(data, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0) {
+        baton->error = "Not a signal log";
+        return;
+    }
+
+    vector<logSeries>& series = baton->series;
+    unordered_map<int, size_t> seriesByKey;
+    size_t offset = sizeof(LOG_MAGIC);
+    while (offset < size) {
+        const unsigned char* record = data + offset;
+        if (record[0] == LOG_RECORD_NAME && size - offset >= 6) {
+            size_t length = ReadLittleEndian(record + 4, 2);
+            if (size - offset - 6 < length) {
+                break;
+            }
+            baton->signalNames[ReadLittleEndian(record + 2, 2)] = string((const char*) record + 6, length);
+            offset += 6 + length;
+        } else if (record[0] == LOG_RECORD_CHUNK && size - offset >= LOG_CHUNK_HEADER_SIZE) {
+            size_t length = LOG_CHUNK_HEADER_SIZE + ReadLittleEndian(record + 20, 4) + ReadLittleEndian(record + 24, 4);
+            if (size - offset < length) {
+                break;
+            }
+            int signal = ReadLittleEndian(record + 2, 2);
+            int sourceAddress = (int16_t) ReadLittleEndian(record + 4, 2);
+            int key = signal << 9 | (sourceAddress + 1);
+            if (seriesByKey.count(key) == 0) {
+                seriesByKey[key] = series.size();
+                logSeries s;
+                s.signal = signal;
+                s.sourceAddress = sourceAddress;
+                series.push_back(s);
+            }
+            if (!DecodeChunk(record, series[seriesByKey[key]])) {
+                break;
+            }
+            offset += length;
+        } else {
+            break;
+        }
+    }
+}
+
+// Calls back readLog with the decoded series. Must run in the V8 thread.
+void AfterReadLogFile(uv_work_t* req, int status /*UNUSED*/) {
+
+    HandleScope scope;
+
+    logWorkBaton* baton = (logWorkBaton*) req->data;
+
+    Local<Value> argv[2];
+    if (!baton->error.empty()) {
+        argv[0] = Exception::Error(String::New(baton->error.c_str()));
+        argv[1] = Local<Value>::New(Undefined());
+    } else {
+        // The samples are copied out whole, not one array element at a time
+        Local<Array> result = Array::New(baton->series.size());
+        for (size_t i = 0; i < baton->series.size(); i++) {
+            const logSeries& series = baton->series[i];
+            size_t bytes = series.timestamps.size() * sizeof(double);
+
+            Local<Object> s = Object::New();
+            s->Set(String::NewSymbol("name"), String::New(baton->signalNames[series.signal].c_str()));
+            if (series.sourceAddress != -1) {
+                s->Set(String::NewSymbol("sourceAddress"), Integer::New(series.sourceAddress));
+            }
+            s->Set(String::NewSymbol("timestamps"),
+                node::Buffer::New((const char*) series.timestamps.data(), bytes)->handle_);
+            s->Set(String::NewSymbol("values"),
+                node::Buffer::New((const char*) series.values.data(), bytes)->handle_);
+            result->Set(i, s);
+        }
+        argv[0] = Local<Value>::New(Null());
+        argv[1] = result;
+    }
+
+    TryCatch tryCatch;
+    baton->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+    if (tryCatch.HasCaught()) {
+        node::FatalException(tryCatch);
+    }
+
+    baton->callback.Dispose();
+    delete baton;
+}
+
+/*
+    Reads a signal log back off the V8 thread. Args should contain the path and a callback,
+    called with an error or an array of { name, sourceAddress, timestamps, values } per
+    signal and source address (J1939 only). timestamps (ms since the epoch) and values are
+    Buffers of doubles in the machine's byte order (little endian on the head unit). A log
+    cut short, say by a power loss, reads up to its last whole chunk.
+*/
+Handle<Value> ReadLog(const Arguments& args) {
+
+    // All V8 functions need a scope
+    HandleScope scope;
+
+    if (args.Length() < 2 || !args[1]->IsFunction()) {
+      return ThrowException(Exception::TypeError(String::New("You must pass a path and a callback")));
+    }
+
+    String::Utf8Value path(args[0]->ToString());
+    logWorkBaton* baton = new logWorkBaton;
+    baton->request.data = (void*) baton;
+    baton->logger = NULL;
+    baton->path = *path;
+    baton->callback = Persistent<Function>::New(Local<Function>::Cast(args[1]));
+    uv_queue_work(uv_default_loop(), &baton->request, ReadLogFile, AfterReadLogFile);
 
     return Undefined();
 }
@@ -848,13 +3690,57 @@ Handle<Value> Start(const Arguments& args) {
 Initializes module. Adds functions to module.
 */
 void RegisterModule(Handle<Object> target) {
-    context = Persistent<Object>::New(target);
+    uv_mutex_init(&writeCompletions.lock);
+    uv_async_init(uv_default_loop(), &writeCompletions.async, ExecuteWriteCallbacks);
+    uv_unref((uv_handle_t*) &writeCompletions.async);
+    uv_mutex_init(&busSnapshots.lock);
+    uv_async_init(uv_default_loop(), &busSnapshots.async, ExecuteAnalyzerCallbacks);
+    uv_unref((uv_handle_t*) &busSnapshots.async);
+    uv_mutex_init(&logLock);
+    uv_cond_init(&logNotEmpty);
+    uv_mutex_init(&subscriptions.lock);
+    subscriptions.version = 0;
+
+    // Assign signal ids
+    definitions.current = BuiltinDefinitions();
+    definitions.epoch = 0;
+    uv_timer_init(uv_default_loop(), &definitions.reclaimTimer);
+    uv_unref((uv_handle_t*) &definitions.reclaimTimer);
+
     target->Set(String::NewSymbol("start"),
         FunctionTemplate::New(Start)->GetFunction());
     target->Set(String::NewSymbol("write"),
         FunctionTemplate::New(Write)->GetFunction());
     target->Set(String::NewSymbol("writeHs"),
         FunctionTemplate::New(WriteHs)->GetFunction());
+    target->Set(String::NewSymbol("writeId"),
+        FunctionTemplate::New(WriteId)->GetFunction());
+    target->Set(String::NewSymbol("signalIds"),
+        FunctionTemplate::New(SignalIds)->GetFunction());
+    target->Set(String::NewSymbol("reloadDefinitions"),
+        FunctionTemplate::New(ReloadDefinitions)->GetFunction());
+    target->Set(String::NewSymbol("startAnalyzer"),
+        FunctionTemplate::New(StartAnalyzer)->GetFunction());
+    target->Set(String::NewSymbol("stopAnalyzer"),
+        FunctionTemplate::New(StopAnalyzer)->GetFunction());
+    target->Set(String::NewSymbol("startLog"),
+        FunctionTemplate::New(StartLog)->GetFunction());
+    target->Set(String::NewSymbol("stopLog"),
+        FunctionTemplate::New(StopLog)->GetFunction());
+    target->Set(String::NewSymbol("readLog"),
+        FunctionTemplate::New(ReadLog)->GetFunction());
+    target->Set(String::NewSymbol("subscribe"),
+        FunctionTemplate::New(Subscribe)->GetFunction());
+    target->Set(String::NewSymbol("unsubscribe"),
+        FunctionTemplate::New(Unsubscribe)->GetFunction());
+    target->Set(String::NewSymbol("aggregate"),
+        FunctionTemplate::New(Aggregate)->GetFunction());
+    target->Set(String::NewSymbol("unaggregate"),
+        FunctionTemplate::New(Unaggregate)->GetFunction());
+    target->Set(String::NewSymbol("openRawTap"),
+        FunctionTemplate::New(OpenRawTap)->GetFunction());
+    target->Set(String::NewSymbol("closeRawTap"),
+        FunctionTemplate::New(CloseRawTap)->GetFunction());
 }
 
 NODE_MODULE(canReadWriter, RegisterModule);